@@ -7,6 +7,11 @@
 
 #include <iostream>
 
+#include <algorithm>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
@@ -29,10 +34,13 @@ void mpi_rec_string( int source_rank , string &str );
 // ****************************************************************************
 ClusterSettings::ClusterSettings( int argc , char **argv ) :
   threshold_( 0.3 ) , singletons_threshold_( -1.0 ) , warm_feeling_( false ) ,
+  num_threads_( 1 ) ,
   output_format_string_( "SAMPLES_FORMAT" ) ,
   input_format_string_( "FLUSH_FPS" ) ,
-  output_format_( SAMPLES_FORMAT ) , input_format_( FLUSH_FPS ) ,
-  binary_file_( false ) , fix_spaces_in_names_( false ) {
+  output_format_( SAMPLES_FORMAT ) , algorithm_string_( "TAYLOR_BUTINA" ) ,
+  algorithm_( TAYLOR_BUTINA ) , jp_num_neighbours_( 10 ) , jp_min_common_( 5 ) ,
+  input_format_( FLUSH_FPS ) ,
+  binary_file_( false ) , fix_spaces_in_names_( false ) , estimate_( false ) {
 
   po::options_description desc( "Allowed Options" );
   build_program_options( desc );
@@ -53,6 +61,7 @@ ClusterSettings::ClusterSettings( int argc , char **argv ) :
   }
 
   decode_formats();
+  decode_thresholds();
 
   ostringstream oss;
   oss << desc;
@@ -63,15 +72,47 @@ ClusterSettings::ClusterSettings( int argc , char **argv ) :
 // ***************************************************************************
 bool ClusterSettings::operator!() const {
 
-  if( input_file_.empty() ) {
+  // from decode_thresholds
+  if( !error_msg_.empty() ) {
+    return true;
+  }
+
+  if( input_file_.empty() && read_nnlists_file_.empty() ) {
     error_msg_ = "No input file specified.";
     return true;
-  } else if( output_file_.empty() ) {
+  } else if( input_file_.empty() &&
+             singletons_threshold_ > *min_element( thresholds_.begin() , thresholds_.end() ) ) {
+    error_msg_ = "Collapsing singletons needs an input file.";
+    return true;
+  } else if( output_file_.empty() && !estimate_ ) {
     error_msg_ = "No output file specified.";
     return true;
-  } else if( threshold_ < 0.0 || threshold_ > 1.0 ) {
-    error_msg_ = string( "Invalid distance threshold " ) +
-      boost::lexical_cast<string>( threshold_ ) + string( "." );
+  } else if( !add_fps_file_.empty() &&
+             ( read_nnlists_file_.empty() || input_file_.empty() ) ) {
+    error_msg_ = "Adding fingerprints needs a neighbour lists file and the input file it was made from.";
+    return true;
+  } else if( estimate_ && input_file_.empty() ) {
+    error_msg_ = "Estimating a run needs an input file.";
+    return true;
+  } else if( estimate_ && LEADER == algorithm_ ) {
+    error_msg_ = "Estimating a run isn't done for the LEADER algorithm.";
+    return true;
+  } else if( num_threads_ < 1 ) {
+    error_msg_ = "Number of threads must be at least 1.";
+    return true;
+  } else if( LEADER == algorithm_ &&
+             ( !read_nnlists_file_.empty() || !write_nnlists_file_.empty() ) ) {
+    error_msg_ = "The LEADER algorithm doesn't use neighbour lists files.";
+    return true;
+  } else if( LEADER == algorithm_ &&
+             singletons_threshold_ > *min_element( thresholds_.begin() , thresholds_.end() ) ) {
+    error_msg_ = "Collapsing singletons isn't done with the LEADER algorithm.";
+    return true;
+  } else if( jp_num_neighbours_ < 1 ) {
+    error_msg_ = "Number of Jarvis-Patrick neighbours must be at least 1.";
+    return true;
+  } else if( jp_min_common_ < 0 || jp_min_common_ > jp_num_neighbours_ ) {
+    error_msg_ = "Jarvis-Patrick minimum common neighbours must be between 0 and the number of neighbours.";
     return true;
   }
 
@@ -79,6 +120,30 @@ bool ClusterSettings::operator!() const {
 
 }
 
+// ****************************************************************************
+// with more than 1 threshold, the threshold goes into the output file name
+// before the extension, if there is one
+string ClusterSettings::output_file( double threshold ) const {
+
+  if( thresholds_.size() < 2 ) {
+    return output_file_;
+  }
+
+  ostringstream oss;
+  oss << "_" << threshold;
+  string thresh_str = oss.str();
+  size_t dot_pos = output_file_.rfind( '.' );
+  size_t slash_pos = output_file_.rfind( '/' );
+  if( string::npos == dot_pos ||
+      ( string::npos != slash_pos && dot_pos < slash_pos ) ) {
+    return output_file_ + thresh_str;
+  }
+
+  return output_file_.substr( 0 , dot_pos ) + thresh_str +
+      output_file_.substr( dot_pos );
+
+}
+
 // ****************************************************************************
 void ClusterSettings::send_contents_via_mpi( int dest_slave ) {
 
@@ -86,14 +151,25 @@ void ClusterSettings::send_contents_via_mpi( int dest_slave ) {
   mpi_send_string( input_file_ , dest_slave );
   mpi_send_string( output_file_ , dest_slave );
   mpi_send_string( subset_file_ , dest_slave );
+  mpi_send_string( read_nnlists_file_ , dest_slave );
+  mpi_send_string( write_nnlists_file_ , dest_slave );
+  mpi_send_string( add_fps_file_ , dest_slave );
 
   MPI_Send( &threshold_ , 1 , MPI_DOUBLE , dest_slave , 0 , MPI_COMM_WORLD );
-  int i( warm_feeling_ );
+  int i = thresholds_.size();
   MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  MPI_Send( &thresholds_[0] , i , MPI_DOUBLE , dest_slave , 0 , MPI_COMM_WORLD );
+  i = int( warm_feeling_ );
+  MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  MPI_Send( &num_threads_ , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
 
   mpi_send_string( input_format_string_ , dest_slave );
   i = int( output_format_ );
   MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  i = int( algorithm_ );
+  MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  MPI_Send( &jp_num_neighbours_ , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  MPI_Send( &jp_min_common_ , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
   i = int( input_format_ );
   MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
   i = int( binary_file_ );
@@ -112,16 +188,27 @@ void ClusterSettings::receive_contents_via_mpi() {
   mpi_rec_string( 0 , input_file_ );
   mpi_rec_string( 0 , output_file_ );
   mpi_rec_string( 0 , subset_file_ );
+  mpi_rec_string( 0 , read_nnlists_file_ );
+  mpi_rec_string( 0 , write_nnlists_file_ );
+  mpi_rec_string( 0 , add_fps_file_ );
 
   MPI_Recv( &threshold_ , 1 , MPI_DOUBLE , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   int i = 0;
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  thresholds_.resize( i );
+  MPI_Recv( &thresholds_[0] , i , MPI_DOUBLE , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   warm_feeling_ = static_cast<bool>( i );
+  MPI_Recv( &num_threads_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
 
   mpi_rec_string( 0 , input_format_string_ );
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   output_format_ = static_cast<OUTPUT_FORMAT>( i );
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  algorithm_ = static_cast<CLUSTER_ALGORITHM>( i );
+  MPI_Recv( &jp_num_neighbours_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &jp_min_common_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   input_format_ = static_cast<DAC_FINGERPRINTS::FP_FILE_FORMAT>( i );
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   binary_file_ = static_cast<bool>( i );
@@ -143,24 +230,40 @@ void ClusterSettings::build_program_options( po::options_description &desc ) {
       "Name of the output clusters file." )
     ( "subset-file,S" , po::value<string>( &subset_file_ ) ,
       "File containing names of fingerprints giving subset to be used in clustering.")
-    ( "threshold,T" , po::value<double>( &threshold_ ) ,
-      "Clustering threshold (default 0.3)" )
+    ( "read-nnlists-file" , po::value<string>( &read_nnlists_file_ ) ,
+      "Neighbour lists file from a previous run, written with --write-nnlists-file. The neighbour lists aren't re-made, so the threshold must be no larger than the one the file was made at." )
+    ( "write-nnlists-file" , po::value<string>( &write_nnlists_file_ ) ,
+      "File to write the neighbour lists to, with distances, for re-use in later runs." )
+    ( "add-fps-file" , po::value<string>( &add_fps_file_ ) ,
+      "Fingerprint file of new fingerprints to add to those in --read-nnlists-file, which must have been made from --input-file. Only the distances from the new fingerprints to all the others are calculated, and the clusters are the same as from a full run on the 2 files joined. Use --write-nnlists-file to keep the merged neighbour lists for next time." )
+    ( "threshold,T" , po::value<vector<string> >( &threshold_strings_ )->multitoken() ,
+      "Clustering threshold (default 0.3). More than 1 can be given, separated by spaces or commas, in which case the neighbour lists are made once and there's an output file for each threshold, with the threshold added to the file name." )
       ( "singletons-threshold" , po::value<double>( &singletons_threshold_ ) ,
         "Threshold for collapsing singletons. Defaults to -1.0, no collapse." )
     ( "warm-feeling,W" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
       "Verbose" )
     ( "verbose,V" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
       "Verbose" )
+    ( "num-threads" , po::value<int>( &num_threads_ ) ,
+      "Number of threads to use in each process (default 1)." )
     ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
       "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
     ( "output-format" , po::value<string>( &output_format_string_ ) ,
       "Output format : CSV_FORMAT|SAMPLES_FORMAT (default SAMPLES_FORMAT)" )
+    ( "algorithm" , po::value<string>( &algorithm_string_ ) ,
+      "Clustering algorithm : TAYLOR_BUTINA|LEADER|JARVIS_PATRICK (default TAYLOR_BUTINA). LEADER reads the fingerprint file once, putting each fingerprint in the cluster of the nearest leader within the threshold or making it a new leader, and only keeps the leaders' fingerprints. JARVIS_PATRICK puts 2 fingerprints in the same cluster if each is in the other's nearest neighbours and they have enough nearest neighbours in common." )
+    ( "jp-num-neighbours" , po::value<int>( &jp_num_neighbours_ ) ,
+      "Number of nearest neighbours, within the threshold, used by JARVIS_PATRICK (default 10)." )
+    ( "jp-min-common" , po::value<int>( &jp_min_common_ ) ,
+      "Number of nearest neighbours 2 fingerprints must have in common to be clustered together by JARVIS_PATRICK (default 5)." )
     ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
       "For bitstrings input, the separator between bits (defaults to no separator)." )
     ( "frag-num-separator" , po::value<string>( &bitstring_separator_ ) ,
       "For fragment numbers input, the separator between numbers (defaults to space)." )
       ( "fix-spaces-in-names" , po::value<bool>( &fix_spaces_in_names_ )->zero_tokens()->default_value( false ) ,
-        "Changes spaces in fingerprint names to \'_\' so as not to mess up SAMPLES format file.");
+        "Changes spaces in fingerprint names to \'_\' so as not to mess up SAMPLES format file.")
+    ( "estimate" , po::value<bool>( &estimate_ )->zero_tokens() ,
+      "Don't do the clustering, but estimate from a sample of the fingerprints the number of neighbours, the memory and the time it would take with the given threshold, number of processes and number of threads.");
   
 }
 
@@ -178,8 +281,82 @@ void ClusterSettings::decode_formats() {
     throw ClusterOutputFormatError( output_format_string_ );
   }
 
+  if( algorithm_string_ == "TAYLOR_BUTINA" ) {
+    algorithm_ = TAYLOR_BUTINA;
+  } else if( algorithm_string_ == "LEADER" ) {
+    algorithm_ = LEADER;
+  } else if( algorithm_string_ == "JARVIS_PATRICK" ) {
+    algorithm_ = JARVIS_PATRICK;
+  } else {
+    throw ClusterAlgorithmError( algorithm_string_ );
+  }
+
   if( FLUSH_FPS == input_format_ || BIN_FRAG_NUMS == input_format_ ) {
     binary_file_ = true;
   }
 
 }
+
+// ***************************************************************************
+// Errors go in error_msg_ for operator! to report, rather than stopping
+// here, so that in a parallel run the master can tell the slaves to finish.
+// A threshold given twice is only done once, as it would be the same
+// output file.
+void ClusterSettings::decode_thresholds() {
+
+  thresholds_.clear();
+  vector<string> given; // as typed, for the messages
+  for( unsigned int i = 0 ; i < threshold_strings_.size() ; ++i ) {
+    vector<string> splits;
+    boost::algorithm::split( splits , threshold_strings_[i] ,
+                             boost::algorithm::is_any_of( "," ) ,
+                             boost::algorithm::token_compress_on );
+    for( unsigned int j = 0 ; j < splits.size() ; ++j ) {
+      if( splits[j].empty() ) {
+        continue;
+      }
+      // lexical_cast takes nan and inf, which -ffast-math can't compare
+      double threshold = 0.0;
+      try {
+        if( string::npos != splits[j].find_first_not_of( "0123456789.eE+-" ) ) {
+          throw boost::bad_lexical_cast();
+        }
+        threshold = boost::lexical_cast<double>( splits[j] );
+      } catch( boost::bad_lexical_cast &e ) {
+        if( error_msg_.empty() ) {
+          error_msg_ = string( "Bad threshold " ) + splits[j] + string( "." );
+        }
+        continue;
+      }
+      if( threshold < 0.0 || threshold > 1.0 ) {
+        if( error_msg_.empty() ) {
+          error_msg_ = string( "Invalid distance threshold " ) + splits[j] +
+              string( ", it must be between 0.0 and 1.0." );
+        }
+        continue;
+      }
+      if( thresholds_.end() == find( thresholds_.begin() , thresholds_.end() ,
+                                     threshold ) ) {
+        thresholds_.push_back( threshold );
+        given.push_back( splits[j] );
+      }
+    }
+  }
+
+  if( thresholds_.empty() ) {
+    thresholds_.push_back( threshold_ );
+  }
+  threshold_ = *max_element( thresholds_.begin() , thresholds_.end() );
+
+  // different thresholds that print the same would still share a file
+  for( unsigned int i = 1 ; i < thresholds_.size() && error_msg_.empty() ; ++i ) {
+    for( unsigned int j = 0 ; j < i ; ++j ) {
+      if( output_file( thresholds_[i] ) == output_file( thresholds_[j] ) ) {
+        error_msg_ = string( "Thresholds " ) + given[j] + string( " and " ) +
+            given[i] + string( " are too close to have different output files." );
+        break;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,249 @@
+//
+// file DistanceHistogram.cc
+// 19th October 2026
+//
+// Counts the distances between a probe and a set of targets into bins.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include <boost/lexical_cast.hpp>
+
+#include "DistanceHistogram.H"
+#include "HashedFingerprint.H"
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// a distance this close to an edge is on it, for bins from bin edges.  The distances between
+// fingerprints are ratios of integers no bigger than the number of bits, so
+// a real difference from an edge is much bigger than this, and anything
+// smaller is rounding.
+static const double EDGE_TOLERANCE = 1.0e-12;
+
+// the number of targets whose bit counts are done before their bins are
+// looked up
+static const unsigned int HISTOGRAM_BATCH_SIZE = 256;
+
+// ***************************************************************************
+DistanceHistogram::DistanceHistogram( const vector<double> &bin_edges ,
+                                      bool upper_inclusive ,
+                                      SIMILARITY_CALC sim_calc ) :
+  bin_edges_( bin_edges ) , upper_inclusive_( upper_inclusive ) ,
+  num_steps_( 0 ) ,
+  num_bins_( bin_edges.size() + ( upper_inclusive ? 0 : 1 ) ) ,
+  table_bits_( 0 ) {
+
+  make_tanimoto_table( sim_calc );
+
+}
+
+// ***************************************************************************
+DistanceHistogram::DistanceHistogram( unsigned int num_steps ,
+                                      bool upper_inclusive ,
+                                      SIMILARITY_CALC sim_calc ) :
+  upper_inclusive_( upper_inclusive ) , num_steps_( num_steps ) ,
+  num_bins_( num_steps ? num_steps + ( upper_inclusive ? 0 : 1 ) : 0 ) ,
+  table_bits_( 0 ) {
+
+  make_tanimoto_table( sim_calc );
+
+}
+
+// ***************************************************************************
+// the table's distances are worked out exactly as HashedFingerprint::tanimoto
+// does them, so they get the same bins
+void DistanceHistogram::make_tanimoto_table( SIMILARITY_CALC sim_calc ) {
+
+  if( !num_bins_ || TANIMOTO != sim_calc ||
+      !HashedFingerprint::num_ints() ||
+      num_bins_ > numeric_limits<unsigned char>::max() ) {
+    return;
+  }
+
+  // the union can't have more bits set than the fingerprint has, and the
+  // number in common can't be more than the union
+  table_bits_ = HashedFingerprint::num_ints() * 8 * sizeof( unsigned int );
+  tanimoto_bins_.resize( ( table_bits_ + 1 ) * ( table_bits_ + 1 ) , 0 );
+  for( unsigned int u = 1 ; u <= table_bits_ ; ++u ) {
+    unsigned char *row = &tanimoto_bins_[u * ( table_bits_ + 1 )];
+    for( unsigned int c = 0 ; c <= u ; ++c ) {
+      row[c] = bin( 1.0 - ( double( c ) / double( u ) ) );
+    }
+  }
+  // 2 empty fingerprints are at distance 0.0
+  tanimoto_bins_[0] = bin( 0.0 );
+
+}
+
+// ***************************************************************************
+unsigned int DistanceHistogram::bin( double dist ) const {
+
+  if( num_steps_ ) {
+    double steps_dist = double( num_steps_ ) * dist;
+    unsigned int b = steps_dist > 0.0 ? static_cast<unsigned int>( steps_dist ) : 0;
+    b = b < num_bins_ ? b : num_bins_ - 1;
+    // bins go to <= dist, so on the border is in the previous bin
+    if( upper_inclusive_ && b && fabs( double( b ) - steps_dist ) < 1.0e-16 ) {
+      --b;
+    }
+    return b;
+  }
+
+  if( upper_inclusive_ ) {
+    unsigned int b = lower_bound( bin_edges_.begin() , bin_edges_.end() ,
+                                  dist - EDGE_TOLERANCE ) - bin_edges_.begin();
+    return b < num_bins_ ? b : num_bins_ - 1;
+  } else {
+    return upper_bound( bin_edges_.begin() , bin_edges_.end() ,
+                        dist + EDGE_TOLERANCE ) - bin_edges_.begin();
+  }
+
+}
+
+// ***************************************************************************
+void DistanceHistogram::add_distances( const FingerprintBase &probe ,
+                                       unsigned int probe_id ,
+                                       const vector<FingerprintBase *> &target_fps ,
+                                       const unsigned int *target_ids ,
+                                       unsigned int *counts ) const {
+
+  if( !tanimoto_bins_.empty() ) {
+    const HashedFingerprint *hprobe = dynamic_cast<const HashedFingerprint *>( &probe );
+    if( hprobe ) {
+      add_tanimoto_distances( *hprobe , probe_id , target_fps , target_ids , counts );
+      return;
+    }
+  }
+
+  for( unsigned int j = 0 , js = target_fps.size() ; j < js ; ++j ) {
+    if( !target_ids || probe_id != target_ids[j] ) {
+      ++counts[bin( target_fps[j]->calc_distance( probe ) )];
+    }
+  }
+
+}
+
+// ***************************************************************************
+// all the fingerprints in a run are the same type, so if the probe is a
+// HashedFingerprint, so are the targets.
+void DistanceHistogram::add_tanimoto_distances( const HashedFingerprint &probe ,
+                                                unsigned int probe_id ,
+                                                const vector<FingerprintBase *> &target_fps ,
+                                                const unsigned int *target_ids ,
+                                                unsigned int *counts ) const {
+
+  unsigned int table_index[HISTOGRAM_BATCH_SIZE];
+  unsigned int probe_bits = probe.num_bits_set();
+  for( unsigned int first = 0 , num_targets = target_fps.size() ;
+       first < num_targets ; first += HISTOGRAM_BATCH_SIZE ) {
+    unsigned int batch_size = min( HISTOGRAM_BATCH_SIZE , num_targets - first );
+    for( unsigned int k = 0 ; k < batch_size ; ++k ) {
+      const HashedFingerprint &target =
+          static_cast<const HashedFingerprint &>( *target_fps[first + k] );
+      unsigned int num_common = probe.num_bits_in_common( target );
+      unsigned int num_union = probe_bits + target.num_bits_set() - num_common;
+      table_index[k] = num_union * ( table_bits_ + 1 ) + num_common;
+    }
+    if( target_ids ) {
+      const unsigned int *batch_ids = target_ids + first;
+      for( unsigned int k = 0 ; k < batch_size ; ++k ) {
+        if( probe_id != batch_ids[k] ) {
+          ++counts[tanimoto_bins_[table_index[k]]];
+        }
+      }
+    } else {
+      for( unsigned int k = 0 ; k < batch_size ; ++k ) {
+        ++counts[tanimoto_bins_[table_index[k]]];
+      }
+    }
+  }
+
+}
+
+// ***************************************************************************
+void DistanceHistogram::add_self_distances( const vector<FingerprintBase *> &fps ,
+                                            const unsigned int *ids ,
+                                            unsigned int i ,
+                                            unsigned int *counts ) const {
+
+  if( !tanimoto_bins_.empty() ) {
+    const HashedFingerprint *hprobe = dynamic_cast<const HashedFingerprint *>( fps[i] );
+    if( hprobe ) {
+      add_tanimoto_self_distances( *hprobe , fps , ids , i , counts );
+      return;
+    }
+  }
+
+  unsigned int *probe_counts = counts + i * num_bins_;
+  for( unsigned int j = i + 1 , js = fps.size() ; j < js ; ++j ) {
+    if( !ids || ids[i] != ids[j] ) {
+      unsigned int b = bin( fps[j]->calc_distance( *fps[i] ) );
+      ++probe_counts[b];
+      ++counts[j * num_bins_ + b];
+    }
+  }
+
+}
+
+// ***************************************************************************
+void DistanceHistogram::add_tanimoto_self_distances( const HashedFingerprint &probe ,
+                                                     const vector<FingerprintBase *> &fps ,
+                                                     const unsigned int *ids ,
+                                                     unsigned int i ,
+                                                     unsigned int *counts ) const {
+
+  unsigned int table_index[HISTOGRAM_BATCH_SIZE];
+  unsigned int probe_bits = probe.num_bits_set();
+  unsigned int *probe_counts = counts + i * num_bins_;
+  for( unsigned int first = i + 1 , num_fps = fps.size() ; first < num_fps ;
+       first += HISTOGRAM_BATCH_SIZE ) {
+    unsigned int batch_size = min( HISTOGRAM_BATCH_SIZE , num_fps - first );
+    for( unsigned int k = 0 ; k < batch_size ; ++k ) {
+      const HashedFingerprint &target =
+          static_cast<const HashedFingerprint &>( *fps[first + k] );
+      unsigned int num_common = probe.num_bits_in_common( target );
+      unsigned int num_union = probe_bits + target.num_bits_set() - num_common;
+      table_index[k] = num_union * ( table_bits_ + 1 ) + num_common;
+    }
+    for( unsigned int k = 0 ; k < batch_size ; ++k ) {
+      if( !ids || ids[i] != ids[first + k] ) {
+        unsigned int b = tanimoto_bins_[table_index[k]];
+        ++probe_counts[b];
+        ++counts[( first + k ) * num_bins_ + b];
+      }
+    }
+  }
+
+}
+
+// ***************************************************************************
+vector<double> parse_bin_edges( const string &edges_string ) {
+
+  vector<double> edges;
+  string edges_copy( edges_string );
+  replace( edges_copy.begin() , edges_copy.end() , ',' , ' ' );
+  istringstream iss( edges_copy );
+  string edge;
+  while( iss >> edge ) {
+    try {
+      edges.push_back( boost::lexical_cast<double>( edge ) );
+    } catch( boost::bad_lexical_cast & ) {
+      throw DistanceHistogramError( string( "Bad bin edge " ) + edge + string( "." ) );
+    }
+    if( edges.size() > 1 && edges.back() <= edges[edges.size() - 2] ) {
+      throw DistanceHistogramError( string( "Bin edges must be in ascending order : " ) +
+                                    edges_string );
+    }
+  }
+  if( edges.empty() ) {
+    throw DistanceHistogramError( string( "No bin edges in " ) + edges_string );
+  }
+  return edges;
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -0,0 +1,106 @@
+//
+// file DiversePickSettings.cc
+// 19th October 2026
+//
+// This class parses the command-line arguments for program diverse_pick and
+// holds the corresponding settings.
+
+#include <iostream>
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include "DiversePickSettings.H"
+
+using namespace std;
+using namespace DAC_FINGERPRINTS;
+namespace po = boost::program_options;
+
+// ***************************************************************************
+DiversePickSettings::DiversePickSettings( int argc , char **argv ) :
+  num_picks_( 0 ) , num_threads_( 1 ) , warm_feeling_( false ) ,
+  binary_file_( false ) , input_format_( FLUSH_FPS ) ,
+  input_format_string_( "FLUSH_FPS" ) {
+
+  po::options_description desc( "Allowed Options" );
+  build_program_options( desc );
+
+  po::variables_map vm;
+  try {
+    po::store( po::parse_command_line( argc , argv , desc ) , vm );
+  } catch( po::error &e ) {
+    cerr << "Error parsing command line : " << e.what() << endl
+         << "diverse_pick aborts." << endl;
+    exit( 1 );
+  }
+  po::notify( vm );
+
+  if( argc < 2 || vm.count( "help" ) ) {
+    cout << desc << endl;
+    exit( 1 );
+  }
+
+  decode_format_string( input_format_string_ , input_format_ ,
+                        binary_file_ , bitstring_separator_ );
+
+  ostringstream oss;
+  oss << desc;
+  usage_text_ = oss.str();
+
+}
+
+// ***************************************************************************
+bool DiversePickSettings::operator!() const {
+
+  if( input_file_.empty() ) {
+    error_msg_ = "No input file specified.";
+    return true;
+  } else if( output_file_.empty() ) {
+    error_msg_ = "No output file specified.";
+    return true;
+  } else if( num_picks_ < 1 ) {
+    error_msg_ = "Number of picks must be at least 1.";
+    return true;
+  } else if( num_threads_ < 1 ) {
+    error_msg_ = "Number of threads must be at least 1.";
+    return true;
+  } else if( !seed_file_.empty() && !first_pick_.empty() ) {
+    error_msg_ = "Can't have both a seed file and a first pick.";
+    return true;
+  }
+
+  return false;
+
+}
+
+// ****************************************************************************
+void DiversePickSettings::build_program_options( po::options_description &desc ) {
+
+  desc.add_options()
+    ( "help" , "Produce this help text." )
+    ( "input-file,I" , po::value<string>( &input_file_ ) ,
+      "Name of fingerprint file to pick from." )
+    ( "output-file,O" , po::value<string>( &output_file_ ) ,
+      "Name of output file." )
+    ( "num-picks,N" , po::value<int>( &num_picks_ ) ,
+      "Number of fingerprints to pick." )
+    ( "seed-file,S" , po::value<string>( &seed_file_ ) ,
+      "Fingerprint file of previous picks.  The new picks are chosen to be diverse from these as well as from each other." )
+    ( "first-pick" , po::value<string>( &first_pick_ ) ,
+      "Name of the fingerprint to pick first, if there's no seed file (default the first in the input file)." )
+    ( "num-threads" , po::value<int>( &num_threads_ ) ,
+      "Number of threads to use (default 1)." )
+    ( "warm-feeling,W" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
+      "Verbose" )
+    ( "verbose,V" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
+      "Verbose" )
+    ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
+      "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+    ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
+      "For bitstrings input, the separator between bits (defaults to no separator)." )
+    ( "frag-num-separator" , po::value<string>( &bitstring_separator_ ) ,
+      "For fragment numbers input, the separator between numbers (defaults to space)." );
+
+}
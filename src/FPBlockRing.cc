@@ -0,0 +1,149 @@
+//
+// file FPBlockRing.cc
+// 19th October 2026
+//
+// A ring of blocks of fingerprints read from a file by one thread and used
+// by several others.
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "FPBlockRing.H"
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+namespace DAC_FINGERPRINTS {
+
+// ***************************************************************************
+FPBlockRing::FPBlockRing( gzFile fp_file , bool byteswapping ,
+                          FP_FILE_FORMAT file_format ,
+                          const string &bitstring_separator ,
+                          unsigned int block_size , unsigned int num_slots ,
+                          unsigned int num_consumers ) :
+  fp_file_( fp_file ) , byteswapping_( byteswapping ) ,
+  file_format_( file_format ) , bitstring_separator_( bitstring_separator ) ,
+  block_size_( block_size ) ,
+  blocks_( num_slots ) , block_nums_( num_slots , -1 ) ,
+  num_released_( num_slots , 0 ) , num_wanted_( num_slots , num_consumers ) ,
+  num_active_consumers_( num_consumers ) , num_blocks_read_( 0 ) ,
+  finished_( false ) , stopped_early_( false ) ,
+  read_secs_( 0.0 ) , reader_wait_secs_( 0.0 ) , consumer_wait_secs_( 0.0 ) {
+
+}
+
+// ***************************************************************************
+FPBlockRing::~FPBlockRing() {
+
+  for( unsigned int i = 0 ; i < blocks_.size() ; ++i ) {
+    free_slot( i );
+  }
+
+}
+
+// ***************************************************************************
+// the block is read without the lock, so the consumers can carry on with
+// the blocks they've got.
+void FPBlockRing::read_blocks() {
+
+  for( unsigned int block_num = 0 ; ; ++block_num ) {
+    unsigned int slot = block_num % blocks_.size();
+    pt::ptime start = pt::microsec_clock::universal_time();
+    {
+      boost::mutex::scoped_lock lock( mutex_ );
+      while( -1 != block_nums_[slot] && num_active_consumers_ ) {
+        block_released_.wait( lock );
+      }
+      if( !num_active_consumers_ ) {
+        finished_ = stopped_early_ = true;
+        return;
+      }
+    }
+    pt::ptime read_start = pt::microsec_clock::universal_time();
+
+    vector<FingerprintBase *> block;
+    block.reserve( block_size_ );
+    read_fps_from_file( fp_file_ , byteswapping_ , file_format_ ,
+                        bitstring_separator_ , 0 , block_size_ , block );
+
+    pt::ptime read_end = pt::microsec_clock::universal_time();
+    boost::mutex::scoped_lock lock( mutex_ );
+    reader_wait_secs_ += ( read_start - start ).total_microseconds() * 1.0e-6;
+    read_secs_ += ( read_end - read_start ).total_microseconds() * 1.0e-6;
+    if( block.empty() ) {
+      finished_ = true;
+      block_read_.notify_all();
+      return;
+    }
+    blocks_[slot].swap( block );
+    block_nums_[slot] = block_num;
+    num_released_[slot] = 0;
+    num_wanted_[slot] = num_active_consumers_;
+    ++num_blocks_read_;
+    block_read_.notify_all();
+  }
+
+}
+
+// ***************************************************************************
+const vector<FingerprintBase *> *FPBlockRing::get_block( unsigned int block_num ) {
+
+  unsigned int slot = block_num % blocks_.size();
+  boost::mutex::scoped_lock lock( mutex_ );
+  if( int( block_num ) != block_nums_[slot] &&
+      !( finished_ && block_num >= num_blocks_read_ ) ) {
+    pt::ptime start = pt::microsec_clock::universal_time();
+    while( int( block_num ) != block_nums_[slot] &&
+           !( finished_ && block_num >= num_blocks_read_ ) ) {
+      block_read_.wait( lock );
+    }
+    consumer_wait_secs_ += ( pt::microsec_clock::universal_time() -
+                             start ).total_microseconds() * 1.0e-6;
+  }
+  if( int( block_num ) == block_nums_[slot] ) {
+    return &blocks_[slot];
+  }
+  return 0;
+
+}
+
+// ***************************************************************************
+void FPBlockRing::release_block( unsigned int block_num ) {
+
+  unsigned int slot = block_num % blocks_.size();
+  boost::mutex::scoped_lock lock( mutex_ );
+  if( ++num_released_[slot] == num_wanted_[slot] ) {
+    free_slot( slot );
+    block_released_.notify_all();
+  }
+
+}
+
+// ***************************************************************************
+// the blocks already read that the consumer hasn't taken no longer wait
+// for it.
+void FPBlockRing::finish_consumer( unsigned int num_blocks_done ) {
+
+  boost::mutex::scoped_lock lock( mutex_ );
+  --num_active_consumers_;
+  for( unsigned int slot = 0 ; slot < blocks_.size() ; ++slot ) {
+    if( block_nums_[slot] >= int( num_blocks_done ) &&
+        num_released_[slot] == --num_wanted_[slot] ) {
+      free_slot( slot );
+    }
+  }
+  block_released_.notify_all();
+
+}
+
+// ***************************************************************************
+void FPBlockRing::free_slot( unsigned int slot ) {
+
+  for( unsigned int i = 0 ; i < blocks_[slot].size() ; ++i ) {
+    delete blocks_[slot][i];
+  }
+  blocks_[slot].clear();
+  block_nums_[slot] = -1;
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
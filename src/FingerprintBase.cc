@@ -11,9 +11,11 @@
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
 #include "HashedFingerprint.H"
+#include "MappedFPFile.H"
 #include "NotHashedFingerprint.H"
 #include "MagicInts.H"
 
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
@@ -33,7 +35,8 @@ FingerprintBase::~FingerprintBase() {
 
 // **************************************************************************
 // open a possibly compressed fingerprint file for reading.  zlib can read
-// an uncompressed file with the same routines as a compressed one.
+// an uncompressed file with the same routines as a compressed one, but an
+// uncompressed flush file is mapped and read from the map instead.
 // Throws a DACLIB::FileReadOpenError if it gets the mood.
 void open_fp_file_for_reading( const string &fp_file ,
                                FP_FILE_FORMAT expected_format ,
@@ -74,6 +77,7 @@ void open_fp_file_for_reading( const string &fp_file ,
       ++num_ints_in_fp;
     }
     HashedFingerprint::set_num_ints( num_ints_in_fp );
+    map_fp_file( fp_file , fp , 2 * sizeof( int ) );
   } else if( FN_MAGIC_INT == file_type || BUGGERED_FN_MAGIC_INT == file_type ) {
     if( expected_format != BIN_FRAG_NUMS ) {
       throw FingerprintFileError( fp_file , expected_format ,
@@ -82,6 +86,7 @@ void open_fp_file_for_reading( const string &fp_file ,
     if( BUGGERED_FP_MAGIC_INT == file_type ) {
       byte_swapping = true;
     }
+    forget_mapped_fp_file( fp );
   } else {
     cerr << "Unrecognised file format for " << fp_file << endl
          << "Possibly it's an older format no longer supported." << endl;
@@ -99,7 +104,16 @@ void open_fp_file_for_reading( const std::string &fp_file , gzFile &fp ) {
   if( !fp ) {
     throw DACLIB::FileReadOpenError( fp_file.c_str() );
   }
-  
+  forget_mapped_fp_file( fp );
+
+}
+
+// **************************************************************************
+void close_fp_file_for_reading( gzFile fp ) {
+
+  forget_mapped_fp_file( fp );
+  gzclose( fp );
+
 }
 
 // **************************************************************************
@@ -215,6 +229,13 @@ string convert_sep_to_new_sep( const string &ins , const string &sep ,
 void read_flush_fp_file( gzFile &fp , bool byteswapping ,
                          vector<FingerprintBase *> &fps ) {
 
+  if( MappedFPFile *mapped_fp = mapped_fp_file( fp ) ) {
+    while( HashedFingerprint *next_fp = mapped_fp->next_fp( byteswapping ) ) {
+      fps.push_back( next_fp );
+    }
+    return;
+  }
+
   HashedFingerprint next_fp( "DUMMY" );
 
   while( 1 ) {
@@ -308,6 +329,7 @@ void read_fp_file( const string &file , FP_FILE_FORMAT input_format ,
 
   read_fp_file( gzfp , byteswapping , input_format , bitstring_separator ,
                 fps );
+  close_fp_file_for_reading( gzfp );
 
 }
 
@@ -323,6 +345,10 @@ FingerprintBase *read_next_fp_from_file( gzFile &fp , bool byteswapping ,
   try {
     switch( file_format ) {
     case FLUSH_FPS :
+      if( MappedFPFile *mapped_fp = mapped_fp_file( fp ) ) {
+        new_fp = mapped_fp->next_fp( byteswapping );
+        break;
+      }
       new_fp = new HashedFingerprint;
       if( !new_fp->binary_read( fp , byteswapping ) ) {
         delete new_fp;
@@ -386,6 +412,24 @@ void read_fps_from_file( gzFile &fp_file , bool byteswapping ,
                          unsigned int first_fp , unsigned int num_fps ,
                          std::vector<FingerprintBase *> &fps ) {
 
+  // the map is only looked up once, rather than for each fingerprint
+  if( MappedFPFile *mapped_fp = mapped_fp_file( fp_file ) ) {
+    string name;
+    for( unsigned int i = 0 ; i < first_fp ; ++i ) {
+      if( !mapped_fp->next_name( byteswapping , name ) ) {
+        return;
+      }
+    }
+    for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+      HashedFingerprint *fp = mapped_fp->next_fp( byteswapping );
+      if( !fp ) {
+        break;
+      }
+      fps.push_back( fp );
+    }
+    return;
+  }
+
   // spin through to first fp of interest
   for( unsigned int i = 0 ; i < first_fp ; ++i ) {
     FingerprintBase *fp = read_next_fp_from_file( fp_file , byteswapping ,
@@ -445,6 +489,14 @@ unsigned int count_fps_in_file( const string &filename ,
   open_fp_file_for_reading( filename , fp_format , byteswapping , fpfile );
 
   unsigned int num_fps = 0;
+  if( MappedFPFile *mapped_fp = mapped_fp_file( fpfile ) ) {
+    string name;
+    while( mapped_fp->next_name( byteswapping , name ) ) {
+      ++num_fps;
+    }
+    close_fp_file_for_reading( fpfile );
+    return num_fps;
+  }
   while( 1 ) {
     FingerprintBase *fp = read_next_fp_from_file( fpfile , byteswapping ,
                                                   fp_format ,
@@ -455,11 +507,75 @@ unsigned int count_fps_in_file( const string &filename ,
     delete fp;
     ++num_fps;
   }
+  close_fp_file_for_reading( fpfile );
 
   return num_fps;
 
 }
 
+// **************************************************************************
+static void pack_int( int i , vector<char> &fp_block ) {
+
+  const char *ic = reinterpret_cast<const char *>( &i );
+  fp_block.insert( fp_block.end() , ic , ic + sizeof( int ) );
+
+}
+
+// **************************************************************************
+static int unpack_int( const vector<char> &fp_block , size_t &pos ) {
+
+  int i;
+  memcpy( &i , &fp_block[pos] , sizeof( int ) );
+  pos += sizeof( int );
+  return i;
+
+}
+
+// **************************************************************************
+void pack_fps( const vector<FingerprintBase *> &fps , vector<char> &fp_block ) {
+
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    string name = fps[i]->get_name();
+    pack_int( name.length() , fp_block );
+    fp_block.insert( fp_block.end() , name.begin() , name.end() );
+    int num_bytes = 0;
+    char *data = fps[i]->data_for_pvm( num_bytes );
+    pack_int( num_bytes , fp_block );
+    fp_block.insert( fp_block.end() , data , data + num_bytes );
+  }
+
+}
+
+// **************************************************************************
+void unpack_fps( FP_FILE_FORMAT fp_format , const vector<char> &fp_block ,
+                 vector<FingerprintBase *> &fps ) {
+
+  size_t pos = 0;
+  vector<unsigned int> bits;
+  while( pos < fp_block.size() ) {
+    int name_len = unpack_int( fp_block , pos );
+    string name( &fp_block[0] + pos , name_len );
+    pos += name_len;
+    int num_bytes = unpack_int( fp_block , pos );
+    // copy the data out in case it isn't aligned
+    bits.resize( num_bytes / sizeof( unsigned int ) );
+    if( num_bytes ) {
+      memcpy( &bits[0] , &fp_block[pos] , num_bytes );
+    }
+    pos += num_bytes;
+    if( FLUSH_FPS == fp_format || BITSTRINGS == fp_format ) {
+      if( !HashedFingerprint::num_ints() ) {
+        HashedFingerprint::set_num_ints( bits.size() );
+      }
+      fps.push_back( new HashedFingerprint( name , &bits[0] ) );
+    } else {
+      fps.push_back( new NotHashedFingerprint( name ,
+                                               vector<uint32_t>( bits.begin() , bits.end() ) ) );
+    }
+  }
+
+}
+
 // **************************************************************************
 void get_fp_names( const std::string &filename ,
                    DAC_FINGERPRINTS::FP_FILE_FORMAT fp_format ,
@@ -469,6 +585,14 @@ void get_fp_names( const std::string &filename ,
   bool byteswapping = false;
   open_fp_file_for_reading( filename , fp_format , byteswapping , fpfile );
 
+  if( MappedFPFile *mapped_fp = mapped_fp_file( fpfile ) ) {
+    string name;
+    while( mapped_fp->next_name( byteswapping , name ) ) {
+      fp_names.push_back( name );
+    }
+    close_fp_file_for_reading( fpfile );
+    return;
+  }
   while( 1 ) {
     FingerprintBase *fp = read_next_fp_from_file( fpfile , byteswapping ,
                                                   fp_format ,
@@ -479,6 +603,7 @@ void get_fp_names( const std::string &filename ,
     fp_names.push_back( fp->get_name() );
     delete fp;
   }
+  close_fp_file_for_reading( fpfile );
 
 }
 
@@ -15,6 +15,7 @@
 
 #include "ByteSwapper.H"
 #include "HashedFingerprint.H"
+#include "MappedFPFile.H"
 
 using namespace std;
 
@@ -33,7 +34,8 @@ static const unsigned int BITS_PER_INT = 8 * sizeof( unsigned int );
 
 // **************************************************************************
 HashedFingerprint::HashedFingerprint() :
-  FingerprintBase() , finger_bits_( 0 ) , num_bits_set_( 0 ) {
+  FingerprintBase() , finger_bits_( 0 ) ,
+  num_bits_set_( 0 ) {
 
   make_zero_fp( num_ints_ * BITS_PER_INT );
 
@@ -41,7 +43,8 @@ HashedFingerprint::HashedFingerprint() :
 
 // **************************************************************************
 HashedFingerprint::HashedFingerprint( const string &name ) :
-  FingerprintBase( name ) , finger_bits_( 0 ) , num_bits_set_( 0 ) {
+  FingerprintBase( name ) , finger_bits_( 0 ) ,
+  num_bits_set_( 0 ) {
 
   make_zero_fp( num_ints_ * BITS_PER_INT );
 
@@ -51,7 +54,8 @@ HashedFingerprint::HashedFingerprint( const string &name ) :
 // this one from the contents of a string built with get_string_rep.
 HashedFingerprint::HashedFingerprint( const string &name ,
                                       const string &rep ) :
-  FingerprintBase( name ) , finger_bits_( 0 ) , num_bits_set_( 0 ) {
+  FingerprintBase( name ) , finger_bits_( 0 ) ,
+  num_bits_set_( 0 ) {
 
   // 10 is the number of chars needed to write
   // numeric_limits<unsigned int>::max() in ascii. At least when I built
@@ -84,7 +88,8 @@ HashedFingerprint::HashedFingerprint( const string &name ,
 // **************************************************************************
 HashedFingerprint::HashedFingerprint( const string &name ,
                                       unsigned int *new_ints ) :
-  FingerprintBase( name ) , finger_bits_( 0 ) , num_bits_set_( 0 ) {
+  FingerprintBase( name ) , finger_bits_( 0 ) ,
+  num_bits_set_( 0 ) {
 
   if( num_ints_ > 0 ) {
     finger_bits_ = new unsigned int[num_ints_];
@@ -95,9 +100,23 @@ HashedFingerprint::HashedFingerprint( const string &name ,
 
 }
 
+// **************************************************************************
+// the map is read-only, so the const is only cast away so that there's one
+// finger_bits_.  Anything that changes the bits calls own_bits first, and a
+// write that didn't would fault rather than change the file's other readers.
+HashedFingerprint::HashedFingerprint( const string &name , const unsigned int *bits ,
+                                      const pFileMap &file_map ) :
+  FingerprintBase( name ) , finger_bits_( const_cast<unsigned int *>( bits ) ) ,
+  file_map_( file_map ) , num_bits_set_( 0 ) {
+
+  count_bits();
+
+}
+
 // **************************************************************************
 HashedFingerprint::HashedFingerprint( const HashedFingerprint &fp ) :
-  FingerprintBase() , finger_bits_( 0 ) , num_bits_set_( 0 ) {
+  FingerprintBase() , finger_bits_( 0 ) ,
+  num_bits_set_( 0 ) {
 
   copy_data( fp );
 
@@ -106,7 +125,9 @@ HashedFingerprint::HashedFingerprint( const HashedFingerprint &fp ) :
 // **************************************************************************
 HashedFingerprint::~HashedFingerprint() {
 
-  delete [] finger_bits_;
+  if( !file_map_ ) {
+    delete [] finger_bits_;
+  }
 
 }
 
@@ -153,6 +174,7 @@ HashedFingerprint HashedFingerprint::operator|( const HashedFingerprint &rhs ) c
 // *******************************************************************************
 HashedFingerprint &HashedFingerprint::operator&=( const HashedFingerprint &rhs ) {
 
+  own_bits();
   for( unsigned int i = 0 ; i < num_ints_ ; ++i ) {
     finger_bits_[i] &= rhs.finger_bits_[i];
   }
@@ -165,6 +187,7 @@ HashedFingerprint &HashedFingerprint::operator&=( const HashedFingerprint &rhs )
 // *******************************************************************************
 HashedFingerprint &HashedFingerprint::operator|=( const HashedFingerprint &rhs ) {
 
+  own_bits();
   for( unsigned int i = 0 ; i < num_ints_ ; ++i ) {
     finger_bits_[i] |= rhs.finger_bits_[i];
   }
@@ -203,13 +226,7 @@ void HashedFingerprint::make_zero_fp( int num_bits ) {
   }
 
   if( num_ints_ ) {
-    if( finger_bits_ && new_num_ints != num_ints_ ) {
-      delete [] finger_bits_;
-      finger_bits_ = 0;
-    }
-    if( !finger_bits_ ) {
-      finger_bits_ = new unsigned int[num_ints_];
-    }
+    own_bits();
     std::fill_n( finger_bits_ , num_ints_ , 0 );
   }
 
@@ -279,7 +296,8 @@ double HashedFingerprint::tversky( const HashedFingerprint &f ,
 // ***************************************************************************
 int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ) const {
 
-  static unsigned int *common_bits = 0;
+  // thread-local so that distances can be calculated in several threads
+  static __thread unsigned int *common_bits = 0;
   if( !common_bits ) {
     common_bits = new unsigned int[num_ints_];
   }
@@ -298,7 +316,7 @@ int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ,
                                            int &num_in_a_not_b ,
                                            int &num_in_b_not_a ) const {
 
-  static unsigned int *common_bits = 0 , *in_a_not_b = 0 , *in_b_not_a = 0;
+  static __thread unsigned int *common_bits = 0 , *in_a_not_b = 0 , *in_b_not_a = 0;
   if( !common_bits ) {
     common_bits = new unsigned int[num_ints_];
     in_a_not_b = new unsigned int[num_ints_];
@@ -324,7 +342,7 @@ int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ,
 // ***************************************************************************
 int HashedFingerprint::num_set_in_this_and_not_in_2( const HashedFingerprint &fp2 ) const {
 
-  static unsigned int *in_this_not_2 = 0;
+  static __thread unsigned int *in_this_not_2 = 0;
   if( !in_this_not_2 ) {
     in_this_not_2 = new unsigned int[num_ints_];
   }
@@ -455,6 +473,7 @@ bool HashedFingerprint::binary_read( gzFile fp , bool byte_swapping ) {
 
   finger_name_.resize( name_len , ' ' );
   gzread( fp , &finger_name_[0] , name_len );
+  own_bits();
   gzread( fp , reinterpret_cast<void *>( finger_bits_ ) , num_ints_ * sizeof( unsigned int ) );
 
   num_bits_set_ = 0; // to force a re-count
@@ -607,15 +626,29 @@ void HashedFingerprint::copy_data( const HashedFingerprint &fp ) {
 
   FingerprintBase::copy_data( fp );
 
-  if( num_ints_ && !finger_bits_ ) {
-    finger_bits_ = new unsigned int[num_ints_];
-  }
+  own_bits();
   copy( fp.finger_bits_ , fp.finger_bits_ + num_ints_ , finger_bits_ );
 
   num_bits_set_ = fp.num_bits_set_;
 
 }
 
+// **************************************************************************
+// bits in a mapped file are shared with everything else read from it, so
+// they're copied before they're changed.
+void HashedFingerprint::own_bits() {
+
+  if( file_map_ ) {
+    unsigned int *new_bits = new unsigned int[num_ints_];
+    copy( finger_bits_ , finger_bits_ + num_ints_ , new_bits );
+    finger_bits_ = new_bits;
+    file_map_.reset();
+  } else if( num_ints_ && !finger_bits_ ) {
+    finger_bits_ = new unsigned int[num_ints_];
+  }
+
+}
+
 // **************************************************************************
 void HashedFingerprint::build_fp_from_bitstring( const string &name ,
                                                  const string &bitstring ) {
@@ -643,6 +676,7 @@ void HashedFingerprint::build_fp_from_bitstring( const string &name ,
   string bits_to_use = padding_needed ?
         spare_bits.substr( 0 , padding_needed ) + bitstring : bitstring;
   num_bits_set_ = 0;
+  own_bits();
 
   static unsigned int *bit_masks = 0;
   if( !bit_masks ) {
@@ -672,6 +706,21 @@ void HashedFingerprint::build_fp_from_bitstring( const string &name ,
 // ****************************************************************************
 int count_bits_set( unsigned int *bits , int num_ints ) {
 
+#if defined(__GNUC__) && ( defined(__SSSE3__) || defined(__SSE2__) )
+  // the popcounts need the bits on a 16-byte boundary, which those in a
+  // mapped file needn't be, but new always gives one
+  if( reinterpret_cast<size_t>( bits ) % 16 ) {
+    static __thread unsigned int *aligned_bits = 0;
+    static __thread int num_aligned_ints = 0;
+    if( num_aligned_ints < num_ints ) {
+      delete [] aligned_bits;
+      aligned_bits = new unsigned int[num_ints];
+      num_aligned_ints = num_ints;
+    }
+    copy( bits , bits + num_ints , aligned_bits );
+    bits = aligned_bits;
+  }
+#endif
 #if defined(__GNUC__) && defined(__SSSE3__)
   return popcount_ssse3( bits , num_ints );
 #elif defined(__GNUC__) && defined(__SSE2__)
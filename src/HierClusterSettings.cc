@@ -0,0 +1,118 @@
+//
+// file HierClusterSettings.cc
+// 19th October 2026
+//
+// This class parses the command-line arguments for program hier_cluster and
+// holds the corresponding settings.
+
+#include <iostream>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include "HierClusterSettings.H"
+
+using namespace std;
+using namespace DAC_FINGERPRINTS;
+namespace po = boost::program_options;
+
+// ***************************************************************************
+HierClusterSettings::HierClusterSettings( int argc , char **argv ) :
+  num_threads_( 1 ) , warm_feeling_( false ) , tversky_alpha_( 0.5F ) ,
+  binary_file_( false ) , input_format_( FLUSH_FPS ) , sim_calc_( TANIMOTO ) ,
+  input_format_string_( "FLUSH_FPS" ) , sim_calc_string_( "TANIMOTO" ) {
+
+  po::options_description desc( "Allowed Options" );
+  build_program_options( desc );
+
+  po::variables_map vm;
+  try {
+    po::store( po::parse_command_line( argc , argv , desc ) , vm );
+  } catch( po::error &e ) {
+    cerr << "Error parsing command line : " << e.what() << endl
+         << "hier_cluster aborts." << endl;
+    exit( 1 );
+  }
+  po::notify( vm );
+
+  if( argc < 2 || vm.count( "help" ) ) {
+    cout << desc << endl;
+    exit( 1 );
+  }
+
+  decode_formats();
+
+  ostringstream oss;
+  oss << desc;
+  usage_text_ = oss.str();
+
+}
+
+// ***************************************************************************
+bool HierClusterSettings::operator!() const {
+
+  if( input_file_.empty() ) {
+    error_msg_ = "No input file specified.";
+    return true;
+  } else if( output_file_.empty() ) {
+    error_msg_ = "No output file specified.";
+    return true;
+  } else if( num_threads_ < 1 ) {
+    error_msg_ = "Number of threads must be at least 1.";
+    return true;
+  } else if( tversky_alpha_ < 0.0F || tversky_alpha_ > 1.0F ) {
+    error_msg_ = string( "Invalid tversky_alpha " ) +
+        boost::lexical_cast<string>( tversky_alpha_ ) + string( "." );
+    return true;
+  }
+
+  return false;
+
+}
+
+// ****************************************************************************
+void HierClusterSettings::build_program_options( po::options_description &desc ) {
+
+  desc.add_options()
+    ( "help" , "Produce this help text." )
+    ( "input-file,I" , po::value<string>( &input_file_ ) ,
+      "Name of input fingerprint file." )
+    ( "output-file,O" , po::value<string>( &output_file_ ) ,
+      "Name of output dendrogram file." )
+    ( "num-threads" , po::value<int>( &num_threads_ ) ,
+      "Number of threads to use (default 1)." )
+    ( "warm-feeling,W" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
+      "Verbose" )
+    ( "verbose,V" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
+      "Verbose" )
+    ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
+      "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+    ( "distance-calculation" , po::value<string>( &sim_calc_string_ ) ,
+      "Distance calculation : TANIMOTO|TVERSKY (default TANIMOTO)" )
+    ( "tversky-alpha" , po::value<float>( &tversky_alpha_ ) ,
+      "Tversky alpha parameter (0.0-1.0, default 0.5)" )
+    ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
+      "For bitstrings input, the separator between bits (defaults to no separator)." )
+    ( "frag-num-separator" , po::value<string>( &bitstring_separator_ ) ,
+      "For fragment numbers input, the separator between numbers (defaults to space)." );
+
+}
+
+// ***************************************************************************
+void HierClusterSettings::decode_formats() {
+
+  decode_format_string( input_format_string_ , input_format_ ,
+                        binary_file_ , bitstring_separator_ );
+
+  if( sim_calc_string_ == "TANIMOTO" ) {
+    sim_calc_ = DAC_FINGERPRINTS::TANIMOTO;
+  } else if( sim_calc_string_ == "TVERSKY" ) {
+    sim_calc_ = DAC_FINGERPRINTS::TVERSKY;
+  } else {
+    throw FingerprintDistCalcError( sim_calc_string_ );
+  }
+
+}
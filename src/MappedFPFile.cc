@@ -0,0 +1,230 @@
+//
+// file MappedFPFile.cc
+// 19th October 2026
+//
+// Uncompressed flush files read through a memory map rather than zlib.
+
+#include <cstring>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "ByteSwapper.H"
+#include "HashedFingerprint.H"
+#include "MappedFPFile.H"
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// a file's map, with what the file was when it was mapped, so that a
+// changed file is mapped again.  The map is only seen, not kept, so that
+// it goes when the readers and fingerprints using it have.
+struct SeenFileMap {
+  string filename_;
+  dev_t dev_;
+  ino_t ino_;
+  off_t size_;
+  time_t mtime_;
+  boost::weak_ptr<FileMap> file_map_;
+};
+
+// The readers are by gzFile, and there's a lock because satan reads its
+// targets in one thread while opening other files in another.  The last
+// fingerprint using a map can go in any thread, but that only unmaps it.
+static vector<SeenFileMap> file_maps;
+static map<gzFile,MappedFPFile *> mapped_files;
+static boost::mutex mapped_files_mutex;
+
+// ***************************************************************************
+FileMap::~FileMap() {
+
+  munmap( start_ , size_ );
+
+}
+
+// ***************************************************************************
+MappedFPFile::MappedFPFile( const pFileMap &file_map , size_t header_size ) :
+  file_map_( file_map ) , pos_( header_size ) {
+
+}
+
+// ***************************************************************************
+HashedFingerprint *MappedFPFile::next_fp( bool byte_swapping ) {
+
+  const char *name;
+  int name_len;
+  const char *bits;
+  size_t next_pos;
+  if( !next_record( byte_swapping , name , name_len , bits , next_pos ) ) {
+    return 0;
+  }
+  pos_ = next_pos;
+
+  if( !( reinterpret_cast<size_t>( bits ) % sizeof( unsigned int ) ) ) {
+    return new HashedFingerprint( string( name , name_len ) ,
+                                  reinterpret_cast<const unsigned int *>( bits ) ,
+                                  file_map_ );
+  }
+  bits_copy_.resize( HashedFingerprint::num_ints() );
+  memcpy( &bits_copy_[0] , bits , bits_copy_.size() * sizeof( unsigned int ) );
+  return new HashedFingerprint( string( name , name_len ) , &bits_copy_[0] );
+
+}
+
+// ***************************************************************************
+bool MappedFPFile::next_name( bool byte_swapping , string &name ) {
+
+  const char *name_start;
+  int name_len;
+  const char *bits;
+  size_t next_pos;
+  if( !next_record( byte_swapping , name_start , name_len , bits , next_pos ) ) {
+    return false;
+  }
+  pos_ = next_pos;
+  name.assign( name_start , name_len );
+  return true;
+
+}
+
+// ***************************************************************************
+// a record is the length of the name, the name and the bits, as written by
+// HashedFingerprint::binary_write
+bool MappedFPFile::next_record( bool byte_swapping , const char *&name ,
+                                int &name_len , const char *&bits ,
+                                size_t &next_pos ) const {
+
+  const char *map_start = file_map_->start();
+  size_t map_size = file_map_->size();
+  if( pos_ > map_size || map_size - pos_ < sizeof( int ) ) {
+    return false;
+  }
+  memcpy( &name_len , map_start + pos_ , sizeof( int ) );
+  if( byte_swapping ) DACLIB::byte_swapper<int>( name_len );
+  size_t num_bytes = HashedFingerprint::num_ints() * sizeof( unsigned int );
+  if( name_len < 0 ||
+      map_size - pos_ - sizeof( int ) < size_t( name_len ) + num_bytes ) {
+    return false;
+  }
+  name = map_start + pos_ + sizeof( int );
+  bits = map_start + pos_ + sizeof( int ) + name_len;
+  next_pos = pos_ + sizeof( int ) + name_len + num_bytes;
+  return true;
+
+}
+
+// ***************************************************************************
+// filename's map, making it if there isn't one for the file as it is now.
+// Empty if it can't be mapped.  The maps that have gone are dropped from
+// file_maps on the way.
+static pFileMap file_map( const string &filename ) {
+
+  for( vector<SeenFileMap>::iterator p = file_maps.begin() ; p != file_maps.end() ; ) {
+    if( p->file_map_.expired() ) {
+      p = file_maps.erase( p );
+    } else {
+      ++p;
+    }
+  }
+
+  int fd = open( filename.c_str() , O_RDONLY );
+  if( -1 == fd ) {
+    return pFileMap();
+  }
+  struct stat file_stat;
+  if( fstat( fd , &file_stat ) || !S_ISREG( file_stat.st_mode ) ||
+      !file_stat.st_size ) {
+    close( fd );
+    return pFileMap();
+  }
+
+  for( unsigned int i = 0 ; i < file_maps.size() ; ++i ) {
+    if( file_maps[i].filename_ == filename &&
+        file_maps[i].dev_ == file_stat.st_dev &&
+        file_maps[i].ino_ == file_stat.st_ino &&
+        file_maps[i].size_ == file_stat.st_size &&
+        file_maps[i].mtime_ == file_stat.st_mtime ) {
+      pFileMap seen_map = file_maps[i].file_map_.lock();
+      if( seen_map ) {
+        close( fd );
+        return seen_map;
+      }
+    }
+  }
+
+  size_t map_size = file_stat.st_size;
+  void *start = mmap( 0 , map_size , PROT_READ , MAP_PRIVATE , fd , 0 );
+  close( fd );
+  if( MAP_FAILED == start ) {
+    return pFileMap();
+  }
+  madvise( start , map_size , MADV_SEQUENTIAL );
+
+  pFileMap new_map( new FileMap( static_cast<char *>( start ) , map_size ) );
+  SeenFileMap seen_map;
+  seen_map.filename_ = filename;
+  seen_map.dev_ = file_stat.st_dev;
+  seen_map.ino_ = file_stat.st_ino;
+  seen_map.size_ = file_stat.st_size;
+  seen_map.mtime_ = file_stat.st_mtime;
+  seen_map.file_map_ = new_map;
+  file_maps.push_back( seen_map );
+
+  return new_map;
+
+}
+
+// ***************************************************************************
+static void forget_mapped_fp_file_locked( gzFile fp ) {
+
+  map<gzFile,MappedFPFile *>::iterator p = mapped_files.find( fp );
+  if( p != mapped_files.end() ) {
+    delete p->second;
+    mapped_files.erase( p );
+  }
+
+}
+
+// ***************************************************************************
+// a gzFile handle can be the same as one that's been closed, so whatever it
+// had before goes first
+void map_fp_file( const string &filename , gzFile fp , size_t header_size ) {
+
+  boost::mutex::scoped_lock lock( mapped_files_mutex );
+  forget_mapped_fp_file_locked( fp );
+  if( !gzdirect( fp ) ) {
+    return;
+  }
+
+  pFileMap new_map = file_map( filename );
+  if( new_map && new_map->size() >= header_size ) {
+    mapped_files[fp] = new MappedFPFile( new_map , header_size );
+  }
+
+}
+
+// ***************************************************************************
+void forget_mapped_fp_file( gzFile fp ) {
+
+  boost::mutex::scoped_lock lock( mapped_files_mutex );
+  forget_mapped_fp_file_locked( fp );
+
+}
+
+// ***************************************************************************
+MappedFPFile *mapped_fp_file( gzFile fp ) {
+
+  boost::mutex::scoped_lock lock( mapped_files_mutex );
+  map<gzFile,MappedFPFile *>::const_iterator p = mapped_files.find( fp );
+  return p == mapped_files.end() ? 0 : p->second;
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -0,0 +1,301 @@
+//
+// file NNListsFile.cc
+// 19th October 2026
+//
+// Reading and writing binary neighbour lists files.
+
+#include <iterator>
+#include <limits>
+
+#include "ByteSwapper.H"
+#include "FileExceptions.H"
+#include "MagicInts.H"
+#include "NNListsFile.H"
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+static const int NNL_FILE_VERSION = 2;
+
+// **************************************************************************
+// gzwrite returns the number of bytes written, which is fewer than asked
+// for if, for example, the disk is full.
+static void write_bytes( const string &filename , gzFile fp , const void *buf ,
+                         unsigned int len ) {
+
+  if( len && int( len ) != gzwrite( fp , buf , len ) ) {
+    throw NNListsFileError( filename , "error writing file." );
+  }
+
+}
+
+// **************************************************************************
+static void write_names( const string &filename , gzFile fp ,
+                         const vector<string> &names ) {
+
+  int num_names = names.size();
+  write_bytes( filename , fp , &num_names , sizeof( int ) );
+  for( int i = 0 ; i < num_names ; ++i ) {
+    int name_len = names[i].length();
+    write_bytes( filename , fp , &name_len , sizeof( int ) );
+    write_bytes( filename , fp , names[i].c_str() , name_len );
+  }
+
+}
+
+// **************************************************************************
+static void read_int( const string &filename , gzFile fp , bool byte_swapping ,
+                      int &i ) {
+
+  if( int( sizeof( int ) ) != gzread( fp , reinterpret_cast<void *>( &i ) , sizeof( int ) ) ) {
+    throw NNListsFileError( filename , "premature end of file in header." );
+  }
+  if( byte_swapping ) DACLIB::byte_swapper<int>( i );
+
+}
+
+// **************************************************************************
+// the counts come from the file, so the names are read a piece at a time
+// rather than making space for them up front, so that a corrupt count
+// gives an error at the end of the file rather than a huge allocation.
+static void read_names( const string &filename , gzFile fp , bool byte_swapping ,
+                        vector<string> &names ) {
+
+  static const int MAX_PIECE = 4096;
+
+  int num_names = 0;
+  read_int( filename , fp , byte_swapping , num_names );
+  if( num_names < 0 ) {
+    throw NNListsFileError( filename , "negative number of names." );
+  }
+  names.clear();
+  char piece[MAX_PIECE];
+  for( int i = 0 ; i < num_names ; ++i ) {
+    int name_len = 0;
+    read_int( filename , fp , byte_swapping , name_len );
+    if( name_len < 0 ) {
+      throw NNListsFileError( filename , "negative name length." );
+    }
+    names.push_back( string() );
+    while( name_len ) {
+      int piece_len = name_len > MAX_PIECE ? MAX_PIECE : name_len;
+      if( piece_len != gzread( fp , piece , piece_len ) ) {
+        throw NNListsFileError( filename , "premature end of file in header." );
+      }
+      names.back().append( piece , piece_len );
+      name_len -= piece_len;
+    }
+  }
+
+}
+
+// **************************************************************************
+void open_nnlists_file_for_writing( const string &filename ,
+                                    double threshold ,
+                                    const vector<string> &fp_names ,
+                                    gzFile &fp ) {
+
+  open_nnlists_file_for_writing( filename , threshold , fp_names ,
+                                 vector<string>() , true , fp );
+
+}
+
+// **************************************************************************
+void open_nnlists_file_for_writing( const string &filename ,
+                                    double threshold ,
+                                    const vector<string> &fp_names ,
+                                    const vector<string> &probe_names ,
+                                    bool compress , gzFile &fp ) {
+
+  // T is zlib for no compression
+  fp = gzopen( filename.c_str() , compress ? "wb" : "wbT" );
+  if( !fp ) {
+    throw DACLIB::FileWriteOpenError( filename.c_str() );
+  }
+
+  try {
+    write_bytes( filename , fp , &NNL_MAGIC_INT , sizeof( unsigned int ) );
+    write_bytes( filename , fp , &NNL_FILE_VERSION , sizeof( int ) );
+    write_bytes( filename , fp , &threshold , sizeof( double ) );
+
+    write_names( filename , fp , fp_names );
+    write_names( filename , fp , probe_names );
+  } catch( NNListsFileError & ) {
+    gzclose( fp );
+    fp = 0;
+    throw;
+  }
+
+}
+
+// **************************************************************************
+static void write_nnlist( const string &filename , gzFile fp , int fp_num ,
+                          NNList::const_iterator start ,
+                          NNList::const_iterator finish ) {
+
+  int num_nbs = distance( start , finish );
+  write_bytes( filename , fp , &fp_num , sizeof( int ) );
+  write_bytes( filename , fp , &num_nbs , sizeof( int ) );
+  if( !num_nbs ) {
+    return;
+  }
+
+  // write the sequence numbers then the distances, each in one go
+  vector<int> nb_nums( num_nbs );
+  vector<float> nb_dists( num_nbs );
+  for( int i = 0 ; i < num_nbs ; ++i , ++start ) {
+    nb_nums[i] = start->first;
+    nb_dists[i] = start->second;
+  }
+  write_bytes( filename , fp , &nb_nums[0] , num_nbs * sizeof( int ) );
+  write_bytes( filename , fp , &nb_dists[0] , num_nbs * sizeof( float ) );
+
+}
+
+// **************************************************************************
+void write_nnlist( const string &filename , gzFile fp , int fp_num ,
+                   const NNList &nbs ) {
+
+  write_nnlist( filename , fp , fp_num , nbs.begin() , nbs.end() );
+
+}
+
+// **************************************************************************
+void write_nnlist_with_seed( const string &filename , gzFile fp ,
+                             const NNList &nbs ) {
+
+  if( nbs.empty() ) {
+    return;
+  }
+  write_nnlist( filename , fp , nbs.front().first , nbs.begin() + 1 , nbs.end() );
+
+}
+
+// **************************************************************************
+// gzclose flushes what zlib is still holding, so it can fail as well.
+void close_nnlists_file( const string &filename , gzFile fp ) {
+
+  if( Z_OK != gzclose( fp ) ) {
+    throw NNListsFileError( filename , "error writing file." );
+  }
+
+}
+
+// **************************************************************************
+void open_nnlists_file_for_reading( const string &filename ,
+                                    double &threshold ,
+                                    vector<string> &fp_names ,
+                                    bool &byte_swapping , gzFile &fp ) {
+
+  vector<string> probe_names;
+  open_nnlists_file_for_reading( filename , threshold , fp_names , probe_names ,
+                                 byte_swapping , fp );
+  if( !probe_names.empty() ) {
+    gzclose( fp );
+    throw NNListsFileError( filename , "the neighbour lists are for a different set of probes." );
+  }
+
+}
+
+// **************************************************************************
+void open_nnlists_file_for_reading( const string &filename ,
+                                    double &threshold ,
+                                    vector<string> &fp_names ,
+                                    vector<string> &probe_names ,
+                                    bool &byte_swapping , gzFile &fp ) {
+
+  fp = gzopen( filename.c_str() , "rb" );
+  if( !fp ) {
+    throw DACLIB::FileReadOpenError( filename.c_str() );
+  }
+
+  unsigned int file_type = 0;
+  gzread( fp , reinterpret_cast<void *>( &file_type ) , sizeof( unsigned int ) );
+  if( NNL_MAGIC_INT == file_type ) {
+    byte_swapping = false;
+  } else if( BUGGERED_NNL_MAGIC_INT == file_type ) {
+    byte_swapping = true;
+  } else {
+    gzclose( fp );
+    throw NNListsFileError( filename , "not a neighbour lists file." );
+  }
+
+  try {
+    int version = 0;
+    read_int( filename , fp , byte_swapping , version );
+    if( version > NNL_FILE_VERSION ) {
+      throw NNListsFileError( filename , "written by a later version of the program." );
+    }
+
+    if( int( sizeof( double ) ) != gzread( fp , reinterpret_cast<void *>( &threshold ) ,
+                                           sizeof( double ) ) ) {
+      throw NNListsFileError( filename , "premature end of file in header." );
+    }
+    if( byte_swapping ) DACLIB::byte_swapper<double>( threshold );
+
+    read_names( filename , fp , byte_swapping , fp_names );
+    probe_names.clear();
+    if( version > 1 ) {
+      read_names( filename , fp , byte_swapping , probe_names );
+    }
+  } catch( NNListsFileError & ) {
+    gzclose( fp );
+    throw;
+  }
+
+}
+
+// **************************************************************************
+// a record that's cut short, which gzread returns fewer bytes than asked
+// for, is an error, as is a negative number of neighbours, but the end of
+// the file before a record starts is just the end.
+bool read_next_nnlist( const string &filename , gzFile fp ,
+                       bool byte_swapping , int &fp_num , NNList &nbs ) {
+
+  int num_read = gzread( fp , reinterpret_cast<void *>( &fp_num ) , sizeof( int ) );
+  if( !num_read && gzeof( fp ) ) {
+    return false;
+  }
+  int num_nbs = 0;
+  if( int( sizeof( int ) ) != num_read ||
+      int( sizeof( int ) ) != gzread( fp , reinterpret_cast<void *>( &num_nbs ) ,
+                                      sizeof( int ) ) ) {
+    throw NNListsFileError( filename , "neighbour list cut short." );
+  }
+  if( byte_swapping ) {
+    DACLIB::byte_swapper<int>( fp_num );
+    DACLIB::byte_swapper<int>( num_nbs );
+  }
+  if( num_nbs < 0 ) {
+    throw NNListsFileError( filename , "negative number of neighbours." );
+  }
+  // gzread can only say it's read up to INT_MAX bytes
+  if( num_nbs > numeric_limits<int>::max() / int( sizeof( int ) ) ) {
+    throw NNListsFileError( filename , "impossible number of neighbours." );
+  }
+
+  nbs.resize( num_nbs );
+  if( !num_nbs ) {
+    return true;
+  }
+  vector<int> nb_nums( num_nbs );
+  vector<float> nb_dists( num_nbs );
+  int nums_size = num_nbs * sizeof( int ) , dists_size = num_nbs * sizeof( float );
+  if( nums_size != gzread( fp , reinterpret_cast<void *>( &nb_nums[0] ) , nums_size ) ||
+      dists_size != gzread( fp , reinterpret_cast<void *>( &nb_dists[0] ) , dists_size ) ) {
+    throw NNListsFileError( filename , "neighbour list cut short." );
+  }
+  for( int i = 0 ; i < num_nbs ; ++i ) {
+    if( byte_swapping ) {
+      DACLIB::byte_swapper<int>( nb_nums[i] );
+      DACLIB::byte_swapper<float>( nb_dists[i] );
+    }
+    nbs[i] = make_pair( nb_nums[i] , nb_dists[i] );
+  }
+
+  return true;
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -0,0 +1,280 @@
+//
+// file RunEstimate.cc
+// 19th October 2026
+//
+// Functions for estimating the cost of a cluster or satan run before doing
+// it.
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include <boost/random/mersenne_twister.hpp>
+
+#include "MappedFPFile.H"
+#include "RunEstimate.H"
+#include "chrono.h"
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// ****************************************************************************
+// the length of the file in bytes, or 0 if there's no telling
+static double file_size( const string &filename ) {
+
+  struct stat file_stat;
+  if( stat( filename.c_str() , &file_stat ) ) {
+    return 0.0;
+  }
+  return double( file_stat.st_size );
+
+}
+
+// ****************************************************************************
+// An uncompressed flush file is mapped, and walking its records without
+// making the fingerprints costs next to nothing, so the count is exact and
+// the sample is spread through the file, one from a random place in each of
+// sample_size even divisions of it, so that a file that repeats itself
+// doesn't give the same fingerprint over and over.
+static void sample_mapped_fp_file( const string &filename , FP_FILE_FORMAT fp_format ,
+                                   const string &bitstring_separator ,
+                                   unsigned int sample_size , unsigned int &num_fps ,
+                                   vector<FingerprintBase *> &sample_fps ) {
+
+  num_fps = count_fps_in_file( filename , fp_format , bitstring_separator );
+  unsigned int num_to_take = min( sample_size , num_fps );
+
+  gzFile fpfile;
+  bool byteswapping = false;
+  open_fp_file_for_reading( filename , fp_format , byteswapping , fpfile );
+  boost::mt19937 rng( 1729 );
+  unsigned int next_fp = 0;
+  for( unsigned int i = 0 ; i < num_to_take ; ++i ) {
+    unsigned int div_start = (unsigned long long)( i ) * num_fps / num_to_take;
+    unsigned int div_end = (unsigned long long)( i + 1 ) * num_fps / num_to_take;
+    unsigned int fp_num = div_start + rng() % ( div_end - div_start );
+    read_fps_from_file( fpfile , byteswapping , fp_format , bitstring_separator ,
+                        fp_num - next_fp , 1 , sample_fps );
+    next_fp = fp_num + 1;
+  }
+  close_fp_file_for_reading( fpfile );
+
+}
+
+// ****************************************************************************
+// The sample is the fingerprints at the start of the file.  If that's all of
+// them, the count is exact and it returns true.  Otherwise, the count is
+// from the file's size, compressed or not, and how much of it the sample
+// took.  A compressed file can't be jumped about in without uncompressing
+// all of it up to the jump, so for one of those, that's the sample.
+static bool sample_start_of_fp_file( gzFile fpfile , bool byteswapping ,
+                                     FP_FILE_FORMAT fp_format ,
+                                     const string &bitstring_separator ,
+                                     double size , unsigned int sample_size ,
+                                     unsigned int &num_fps ,
+                                     vector<FingerprintBase *> &sample_fps ) {
+
+  read_next_fps_from_file( fpfile , byteswapping , fp_format , bitstring_separator ,
+                           sample_size , sample_fps );
+  num_fps = sample_fps.size();
+  if( num_fps < sample_size ) {
+    return true;
+  }
+  FingerprintBase *fp = read_next_fp_from_file( fpfile , byteswapping , fp_format ,
+                                                bitstring_separator );
+  if( !fp ) {
+    return true;
+  }
+  delete fp;
+  double bytes_read = gzoffset( fpfile );
+  if( bytes_read > 0.0 ) {
+    num_fps = max( num_fps + 1 ,
+                   (unsigned int)( size * ( num_fps + 1 ) / bytes_read + 0.5 ) );
+  }
+  return false;
+
+}
+
+// ****************************************************************************
+// An uncompressed text file is one fingerprint a line, and can be jumped
+// about in, so the sample is the first whole line after a random place in
+// each of sample_size even divisions of the file, and the count is from the
+// file size and the mean length of those lines.
+static void sample_text_fp_file( gzFile fpfile , FP_FILE_FORMAT fp_format ,
+                                 const string &bitstring_separator ,
+                                 double size , unsigned int sample_size ,
+                                 unsigned int &num_fps ,
+                                 vector<FingerprintBase *> &sample_fps ) {
+
+  boost::mt19937 rng( 1729 );
+  double bytes_read = 0.0;
+  z_off_t next_line = 0;
+  for( unsigned int i = 0 ; i < sample_size ; ++i ) {
+    z_off_t div_start = z_off_t( size * i / sample_size );
+    z_off_t div_end = z_off_t( size * ( i + 1 ) / sample_size );
+    z_off_t pos = div_start + rng() % max( z_off_t( 1 ) , div_end - div_start );
+    if( pos <= next_line ) {
+      // don't take the same line twice
+      gzseek( fpfile , next_line , SEEK_SET );
+    } else {
+      // the line pos - 1 is in has been started already
+      gzseek( fpfile , pos - 1 , SEEK_SET );
+      read_full_line( fpfile );
+    }
+    z_off_t line_start = gztell( fpfile );
+    FingerprintBase *fp = read_next_fp_from_file( fpfile , false , fp_format ,
+                                                  bitstring_separator );
+    if( !fp ) {
+      break;
+    }
+    sample_fps.push_back( fp );
+    next_line = gztell( fpfile );
+    bytes_read += next_line - line_start;
+  }
+
+  num_fps = sample_fps.size();
+  if( bytes_read > 0.0 ) {
+    num_fps = max( num_fps ,
+                   (unsigned int)( size * sample_fps.size() / bytes_read + 0.5 ) );
+  }
+
+}
+
+// ****************************************************************************
+void sample_fp_file( const string &filename , FP_FILE_FORMAT fp_format ,
+                     const string &bitstring_separator ,
+                     unsigned int sample_size , unsigned int &num_fps ,
+                     vector<FingerprintBase *> &sample_fps ) {
+
+  gzFile fpfile;
+  bool byteswapping = false;
+  open_fp_file_for_reading( filename , fp_format , byteswapping , fpfile );
+
+  if( mapped_fp_file( fpfile ) ) {
+    close_fp_file_for_reading( fpfile );
+    sample_mapped_fp_file( filename , fp_format , bitstring_separator ,
+                           sample_size , num_fps , sample_fps );
+    return;
+  }
+
+  double size = file_size( filename );
+  if( !sample_start_of_fp_file( fpfile , byteswapping , fp_format ,
+                                bitstring_separator , size , sample_size ,
+                                num_fps , sample_fps ) &&
+      ( BITSTRINGS == fp_format || FRAG_NUMS == fp_format ) && gzdirect( fpfile ) ) {
+    for( int i = 0 , is = sample_fps.size() ; i < is ; ++i ) {
+      delete sample_fps[i];
+    }
+    sample_fps.clear();
+    sample_text_fp_file( fpfile , fp_format , bitstring_separator , size ,
+                         sample_size , num_fps , sample_fps );
+  }
+  close_fp_file_for_reading( fpfile );
+
+}
+
+// ****************************************************************************
+void sample_distances( const vector<FingerprintBase *> &probe_fps ,
+                       const vector<FingerprintBase *> &target_fps ,
+                       bool same_set , double threshold ,
+                       double &num_pairs , double &num_hits ,
+                       double &secs_per_dist ) {
+
+  num_pairs = num_hits = secs_per_dist = 0.0;
+  Chronograph chrono;
+  for( int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
+    for( int j = 0 , js = target_fps.size() ; j < js ; ++j ) {
+      if( same_set && i == j ) {
+        continue;
+      }
+      num_pairs += 1.0;
+      if( target_fps[j]->calc_distance( *probe_fps[i] , threshold ) <= threshold ) {
+        num_hits += 1.0;
+      }
+    }
+  }
+  if( num_pairs > 0.0 ) {
+    secs_per_dist = chrono.elapsed() / num_pairs;
+  }
+
+}
+
+// ****************************************************************************
+// pack_fps gives the name and the bits, and there's the object and the
+// pointer to it on top of that.
+double mean_fp_bytes( const vector<FingerprintBase *> &fps ) {
+
+  if( fps.empty() ) {
+    return 0.0;
+  }
+  vector<char> fp_block;
+  pack_fps( fps , fp_block );
+  return double( fp_block.size() ) / double( fps.size() ) +
+      sizeof( FingerprintBase ) + sizeof( FingerprintBase * );
+
+}
+
+// ****************************************************************************
+double mean_name_length( const vector<FingerprintBase *> &fps ) {
+
+  if( fps.empty() ) {
+    return 0.0;
+  }
+  double tot_len = 0.0;
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    tot_len += fps[i]->get_name().length();
+  }
+  return tot_len / double( fps.size() );
+
+}
+
+// ****************************************************************************
+// counting statistics - the standard deviation of a count n is about
+// sqrt(n).  With no hits at all, there's no telling.
+double hits_error( double num_hits ) {
+
+  if( num_hits < 1.0 ) {
+    return 100.0;
+  }
+  return 100.0 / sqrt( num_hits );
+
+}
+
+// ****************************************************************************
+string bytes_string( double num_bytes ) {
+
+  static const char *units[] = { "bytes" , "KB" , "MB" , "GB" , "TB" , "PB" };
+  int i = 0;
+  while( num_bytes >= 1024.0 && i < 5 ) {
+    num_bytes /= 1024.0;
+    ++i;
+  }
+  ostringstream oss;
+  oss << fixed << setprecision( i ? 1 : 0 ) << num_bytes << " " << units[i];
+  return oss.str();
+
+}
+
+// ****************************************************************************
+string time_string( double secs ) {
+
+  ostringstream oss;
+  if( secs < 60.0 ) {
+    oss << fixed << setprecision( 1 ) << secs << " s";
+  } else if( secs < 3600.0 ) {
+    oss << int( secs / 60.0 ) << " m " << int( fmod( secs , 60.0 ) ) << " s";
+  } else if( secs < 86400.0 ) {
+    oss << int( secs / 3600.0 ) << " h " << int( fmod( secs , 3600.0 ) / 60.0 )
+        << " m";
+  } else {
+    oss << int( secs / 86400.0 ) << " d " << int( fmod( secs , 86400.0 ) / 3600.0 )
+        << " h";
+  }
+  return oss.str();
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
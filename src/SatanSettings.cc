@@ -29,8 +29,9 @@ void mpi_rec_string( int source_rank , string &str );
 // ***************************************************************************
 SatanSettings::SatanSettings( int argc , char **argv ) :
   threshold_( 0.3 ) , min_count_( 0 ) , probe_chunk_size_( -1 ) ,
-  tversky_alpha_( 0.5F ) ,
-  warm_feeling_( false ) , binary_file_( false ) ,
+  num_threads_( 1 ) , target_block_size_( 10000 ) , shard_targets_( false ) ,
+  compress_results_( false ) , self_search_( false ) , tversky_alpha_( 0.5F ) ,
+  warm_feeling_( false ) , binary_file_( false ) , estimate_( false ) ,
   input_format_( FLUSH_FPS ) , sim_calc_( TANIMOTO ) ,
   input_format_string_( "FLUSH_FPS" ) , output_format_string_( "SATAN" ) ,
   sim_calc_string_( "TANIMOTO" ) {
@@ -54,6 +55,11 @@ SatanSettings::SatanSettings( int argc , char **argv ) :
     exit( 1 );
   }
 
+  // with --self, the probe file is the target file too
+  if( self_search_ && target_file_.empty() ) {
+    target_file_ = probe_file_;
+  }
+
   decode_formats();
 
   ostringstream oss;
@@ -71,7 +77,7 @@ bool SatanSettings::operator!() const {
   } else if( target_file_.empty() ) {
     error_msg_ = "No target file specified.";
     return true;
-  } else if( output_file_.empty() ) {
+  } else if( output_file_.empty() && !estimate_ ) {
     error_msg_ = "No output file specified.";
     return true;
   } else if( threshold_ < 0.0 || threshold_ > 1.0 ) {
@@ -82,13 +88,32 @@ bool SatanSettings::operator!() const {
     error_msg_ = string( "Invalid tversky_alpha " ) +
         boost::lexical_cast<string>( threshold_ ) + string( "." );
     return true;
+  } else if( num_threads_ < 1 ) {
+    error_msg_ = "Number of threads must be at least 1.";
+    return true;
+  } else if( 0 == probe_chunk_size_ || probe_chunk_size_ < -1 ) {
+    error_msg_ = "Probe chunk size must be at least 1.";
+    return true;
+  } else if( target_block_size_ < 1 ) {
+    error_msg_ = "Target block size must be at least 1.";
+    return true;
+  } else if( self_search_ && target_file_ != probe_file_ ) {
+    error_msg_ = "With --self, the target file must be the probe file, or not given.";
+    return true;
+  } else if( self_search_ && DAC_FINGERPRINTS::TVERSKY == sim_calc_ ) {
+    error_msg_ = "The Tversky distance isn't symmetric, so can't be used with --self.";
+    return true;
+  } else if( self_search_ && ( shard_targets_ || probe_chunk_size_ > 0 ) ) {
+    error_msg_ = "--self can't be used with --shard-targets or --probe-chunk-size.";
+    return true;
   }
 
   if( string( "SATAN" ) != output_format_string_ &&
       string( "NNLISTS" ) != output_format_string_ &&
-      string( "COUNTS" ) != output_format_string_ ) {
+      string( "COUNTS" ) != output_format_string_ &&
+      string( "BINARY" ) != output_format_string_ ) {
     error_msg_ = string( "Invalid output format string : " ) + output_format_string_ +
-        string( "\nMust be one of SATAN or NNLISTS or COUNTS.\n" );
+        string( "\nMust be one of SATAN or NNLISTS or COUNTS or BINARY.\n" );
     return true;
   }
 
@@ -105,6 +130,14 @@ void SatanSettings::send_contents_via_mpi( int dest_rank ) {
   MPI_Send( &threshold_ , 1 , MPI_DOUBLE , dest_rank , 0 , MPI_COMM_WORLD );
   MPI_Send( &min_count_ , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
   MPI_Send( &probe_chunk_size_ , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  MPI_Send( &num_threads_ , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  MPI_Send( &target_block_size_ , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  int shard = int( shard_targets_ );
+  MPI_Send( &shard , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  int compress = int( compress_results_ );
+  MPI_Send( &compress , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  int self = int( self_search_ );
+  MPI_Send( &self , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
   MPI_Send( &tversky_alpha_ , 1 , MPI_FLOAT , dest_rank , 0 , MPI_COMM_WORLD );
   int i = int( binary_file_ );
   MPI_Send( &i , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
@@ -129,6 +162,17 @@ void SatanSettings::receive_contents_via_mpi() {
   MPI_Recv( &threshold_ , 1 , MPI_DOUBLE , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   MPI_Recv( &min_count_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   MPI_Recv( &probe_chunk_size_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &num_threads_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &target_block_size_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  int shard;
+  MPI_Recv( &shard , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  shard_targets_ = static_cast<bool>( shard );
+  int compress;
+  MPI_Recv( &compress , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  compress_results_ = static_cast<bool>( compress );
+  int self;
+  MPI_Recv( &self , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  self_search_ = static_cast<bool>( self );
   MPI_Recv( &tversky_alpha_ , 1 , MPI_FLOAT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   int i;
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
@@ -161,7 +205,17 @@ void SatanSettings::build_program_options( po::options_description &desc ) {
       ( "min-count,M" , po::value<int>( &min_count_ ) ,
         "Minimum neighbour count, defaults to 0 (report all neighbours)" )
       ( "probe-chunk-size" , po::value<int>( &probe_chunk_size_ ) ,
-        "Controls the size of the pieces in which the probe is dealt with. Needs to be relatively small for large jobs." )
+        "Controls the size of the pieces in which the probe is dealt with. Needs to be relatively small for large jobs. Each piece's results are written before the next is done, and in a parallel run the pieces are handed out to the slaves as they become free. Defaults to all the probes at once, or 4 chunks for each slave." )
+      ( "num-threads" , po::value<int>( &num_threads_ ) ,
+        "Number of threads to use in each process (default 1)." )
+      ( "target-block-size" , po::value<int>( &target_block_size_ ) ,
+        "Number of targets read and searched at a time (default 10000). The next block is read by another thread while the current one is searched." )
+      ( "shard-targets" , po::value<bool>( &shard_targets_ )->zero_tokens() ,
+        "In a parallel run, the master reads the target file once and deals it out to the slaves in blocks, and the probes are sent to every slave, rather than each slave doing a share of the probes against the whole target file. For when reading the target file is the bottleneck." )
+      ( "compress-results" , po::value<bool>( &compress_results_ )->zero_tokens() ,
+        "In a parallel run, the slaves compress their results before sending them to the master. Worth it if the network is slow." )
+      ( "self" , po::value<bool>( &self_search_ )->zero_tokens() ,
+        "Search the probe file against itself, which is then also the target file. Each pair is only compared once, so it takes about half the time, with the same output as the ordinary search. All the fingerprints and their neighbours are held in memory, so it can't be used with --probe-chunk-size or --shard-targets, and it needs a symmetric distance, so not TVERSKY. With --min-count, every pair is still compared." )
       ( "warm-feeling,W" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
         "Verbose" )
       ( "verbose,V" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
@@ -169,7 +223,7 @@ void SatanSettings::build_program_options( po::options_description &desc ) {
       ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
         "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
       ( "output-format" , po::value<string>( &output_format_string_ ) ,
-        "Output format : SATAN|NNLISTS|COUNTS (default SATAN)" )
+        "Output format : SATAN|NNLISTS|COUNTS|BINARY (default SATAN). BINARY is a neighbour lists file, compressed if the output file name ends in .gz, that nnlists_to_text turns into SATAN or NNLISTS, and that cluster can read if the probe and target files are the same." )
       ( "distance-calculation" , po::value<string>( &sim_calc_string_ ) ,
         "Distance calculation : TANIMOTO|TVERSKY (default TANIMOTO)" )
       ( "tversky-alpha" , po::value<float>( &tversky_alpha_ ) ,
@@ -177,7 +231,9 @@ void SatanSettings::build_program_options( po::options_description &desc ) {
       ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
         "For bitstrings input, the separator between bits (defaults to no separator)." )
       ( "frag-num-separator" , po::value<string>( &bitstring_separator_ ) ,
-        "For fragment numbers input, the separator between numbers (defaults to space)." );
+        "For fragment numbers input, the separator between numbers (defaults to space)." )
+      ( "estimate" , po::value<bool>( &estimate_ )->zero_tokens() ,
+        "Don't do the search, but estimate from samples of the probes and targets the number of neighbours, the memory, the output size and the time it would take with the given threshold, number of processes and number of threads." );
   
 }
 
@@ -0,0 +1,219 @@
+//
+// file SatanTextOutput.cc
+// 19th October 2026
+//
+// Writing neighbour lists and counts in satan's text formats.
+
+#include <iomanip>
+#include <iostream>
+
+#include <boost/foreach.hpp>
+
+#include "SatanTextOutput.H"
+
+using namespace std;
+
+// ****************************************************************************
+static void output_neighbours_satan( unsigned int min_count ,
+                                     ostream &output_stream ,
+                                     vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    if( min_count && (nbs[i].second).size() >= min_count ) {
+      for( unsigned int j = 0 ; j < min_count ; ++j ) {
+        output_stream << nbs[i].first << " "
+                      << (nbs[i].second)[j].first << " "
+                      << (nbs[i].second)[j].second << endl;
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+static void output_neighbours_satan( ostream &output_stream ,
+                                     vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    for( unsigned int j = 0 , js = (nbs[i].second).size() ; j < js ; ++j ) {
+      output_stream << nbs[i].first << " "
+                    << (nbs[i].second)[j].first << " "
+                    << (nbs[i].second)[j].second << endl;
+    }
+  }
+
+}
+
+// ****************************************************************************
+static unsigned int max_probe_name_len( const vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  unsigned int max_len = 0;
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    if( (nbs[i].first).length() > max_len ) {
+      max_len = (nbs[i].first).length();
+    }
+  }
+
+  return max_len;
+
+}
+
+// ****************************************************************************
+static unsigned int max_target_name_len( const vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  unsigned int max_len = 0;
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    for( int k = 0 , ks = (nbs[i].second).size() ; k < ks ; ++k ) {
+      if( (nbs[i].second)[k].first.length() > max_len ) {
+        max_len = (nbs[i].second)[k].first.length();
+      }
+    }
+  }
+
+  return max_len;
+
+}
+
+// ****************************************************************************
+static unsigned int max_count_name_len( const vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  unsigned int max_len = 0;
+  typedef pair<string,vector<unsigned int> > SVUI;
+  BOOST_FOREACH( SVUI cnt , counts ) {
+    if( cnt.first.length() > max_len ) {
+      max_len = cnt.first.length();
+    }
+  }
+
+  return max_len;
+}
+
+// ****************************************************************************
+static void pad_spaces( unsigned int str_len , unsigned int max_len ,
+                        bool with_colon , ostream &output_stream ) {
+
+  // this is the way that snailflush does it - I can't remember why, but I
+  // know there ought to be a better way.
+  for( unsigned int i = str_len ; i <= max_len ; ++i ) {
+    output_stream << " ";
+  }
+  if( with_colon ) {
+    output_stream << "  : ";
+  }
+
+}
+
+// ****************************************************************************
+static void output_neighbours_nnlists( unsigned int min_count ,
+                                       ostream &output_stream ,
+                                       vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  // snailflush pads the nnlists with spaces so all records are the same length.
+  // Do the same here for consistency, but bearing in mind that it might
+  // not be completely kosher as the probes are being done in batches.
+  unsigned int max_probe_len = max_probe_name_len( nbs );
+  unsigned int max_target_len = max_target_name_len( nbs );
+
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    if( min_count && (nbs[i].second).size() >= min_count ) {
+      output_stream << nbs[i].first;
+      pad_spaces( nbs[i].first.length() , max_probe_len , true , output_stream );
+      output_stream << endl;
+
+      for( unsigned int j = 0 ; j < min_count ; ++j ) {
+        // for nnlists, by tradition we don't output the neighbour if it appears
+        // to be the same molecule
+        if( (nbs[i].second)[j].second == 0.0F &&
+            (nbs[i].second)[j].first == nbs[i].first ) {
+          continue;
+        }
+        output_stream << "      " << (nbs[i].second)[j].first;
+        pad_spaces( (nbs[i].second)[j].first.length() , max_target_len ,
+                    true , output_stream );
+        output_stream << setw( 6 ) << setprecision( 4 )
+                      << setiosflags( ios::showpoint )
+                      << (nbs[i].second)[j].second << endl;
+      }
+      output_stream << endl;
+    }
+  }
+
+}
+
+// ****************************************************************************
+static void output_neighbours_nnlists( ostream &output_stream ,
+                                       vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  // snailflush pads the nnlists with spaces so all records are the same length.
+  // Do the same here for consistency, but bearing in mind that it might
+  // not be completely kosher as the probes are being done in batches.
+  unsigned int max_probe_len = max_probe_name_len( nbs );
+  unsigned int max_target_len = max_target_name_len( nbs );
+
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    output_stream << nbs[i].first;
+    pad_spaces( nbs[i].first.length() , max_probe_len , true , output_stream );
+    output_stream << endl;
+
+    for( unsigned int j = 0 , js = (nbs[i].second).size() ; j < js ; ++j ) {
+      // for nnlists, by tradition we don't output the neighbour if it appears
+      // to be the same molecule
+      if( (nbs[i].second)[j].second == 0.0F &&
+          (nbs[i].second)[j].first == nbs[i].first ) {
+        continue;
+      }
+      output_stream << "      " << (nbs[i].second)[j].first;
+      pad_spaces( (nbs[i].second)[j].first.length() , max_target_len ,
+                  true , output_stream );
+      output_stream << setw( 6 ) << setprecision( 4 )
+                    << setiosflags( ios::showpoint )
+                    << (nbs[i].second)[j].second << endl;
+    }
+    output_stream << endl;
+  }
+
+}
+
+// ****************************************************************************
+void output_neighbours( unsigned int min_count , const string &output_format ,
+                        ostream &output_stream ,
+                        vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  if( min_count ) {
+    if( string( "SATAN" ) == output_format ) {
+      output_neighbours_satan( min_count , output_stream , nbs );
+    } else {
+      output_neighbours_nnlists( min_count , output_stream , nbs );
+    }
+  } else {
+    if( string( "SATAN" ) == output_format ) {
+      output_neighbours_satan( output_stream , nbs );
+    } else {
+      output_neighbours_nnlists( output_stream , nbs );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void output_counts( ostream &output_stream ,
+                    vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  // snailflush pads the nnlists with spaces so all records are the same length.
+  // Do the same here for consistency, but bearing in mind that it might
+  // not be completely kosher as the probes are being done in batches.
+  unsigned int max_name_len = max_count_name_len( counts );
+
+  for( int i = 0 , is = counts.size() ; i < is ; ++i ) {
+    output_stream << counts[i].first;
+    pad_spaces( counts[i].first.length() , max_name_len + 3 ,
+                false , output_stream );
+    int sum_count = 0;
+    for( int j = 0 ; j < 10 ; ++j ) {
+      sum_count += counts[i].second[j];
+      output_stream << setw( 6 ) << sum_count << "  ";
+    }
+    output_stream << endl;
+  }
+
+}
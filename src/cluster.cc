@@ -7,6 +7,8 @@
 // Does a sphere-exclusion clustering on a fingerprint file.
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <iterator>
 #include <fstream>
@@ -21,12 +23,14 @@
 #include "HashedFingerprint.H"
 #include "NotHashedFingerprint.H"
 #include "FileExceptions.H"
+#include "NNListsFile.H"
+#include "ParallelLoop.H"
+#include "RunEstimate.H"
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/bind.hpp>
-#include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -53,6 +57,8 @@ string get_cwd();
 // In mpi_string_subs.cc
 void mpi_send_string( const string &str , int dest_rank );
 void mpi_rec_string( int source_rank , string &str );
+void send_block( const vector<char> &block , int dest_rank );
+void receive_block( int source_rank , vector<char> &block );
 }
 
 using namespace DAC_FINGERPRINTS;
@@ -132,47 +138,12 @@ string fix_spaces_in_fp_name( const string &fp_name , bool verbose ) {
 }
 
 // *******************************************************************************
-// read the fingerprint file, keeping only seeds and singleton fps
-void read_fp_file( ClusterSettings cs , const vector<string> &seed_names ,
-                   const vector<string> &singleton_names ,
-                   vector<pFB> &seed_fps , vector<pFB> &singleton_fps ) {
-
-  gzFile fpfile;
-  bool byteswapping;
-  open_fp_file( cs.input_file() , cs.input_format() , byteswapping , fpfile );
-
-  while( 1 ) {
-    pFB fp( read_next_fp_from_file( fpfile , byteswapping , cs.input_format() ,
-                                    cs.bitstring_separator() ) );
-    if( !fp ) {
-      break;
-    }
-    if( SAMPLES_FORMAT == cs.output_format() ) {
-      // if we've got this far and there's a space in the name, we need to fix it.
-      // We'd have stopped by now if that was not the case.
-      fp->set_name( fix_spaces_in_fp_name( fp->get_name() , false ) );
-    }
-
-    if( binary_search( seed_names.begin() , seed_names.end() ,
-                       fp->get_name() ) ) {
-      seed_fps.push_back( fp );
-    }
-    if( binary_search( singleton_names.begin() , singleton_names.end() ,
-                       fp->get_name() ) ) {
-      singleton_fps.push_back( fp );
-    }
-  }
-
-}
-
-// *******************************************************************************
-void fps_to_name( vector<pFB> &fps , vector<string> &fp_names ) {
+void fps_to_name( const vector<pFB> &fps , vector<string> &fp_names ) {
 
   fp_names.reserve( fps.size() );
   for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
     fp_names.push_back( fps[i]->get_name() );
   }
-  fps.clear();
 
 }
 
@@ -188,42 +159,85 @@ void apply_subset( ClusterSettings &cs , vector<pFB> &fps ) {
 }
 
 // *******************************************************************************
-void make_nnlists( bool warm_feeling , double threshold ,
+// The distances are kept as floats, but whether a neighbour is within a
+// threshold is decided on the double. A distance just inside a threshold can
+// round up to it as a float, in which case it's nudged down to the float
+// below so that nnlists_at_threshold gets the same answer.
+float dist_for_nnlist( double dist , const vector<double> &thresholds ) {
+
+  float fdist = dist;
+  for( int i = 0 , is = thresholds.size() ; i < is ; ++i ) {
+    float fthresh = thresholds[i];
+    if( dist < thresholds[i] && fdist >= fthresh ) {
+      fdist = nextafterf( fthresh , 0.0F );
+    }
+  }
+  return fdist;
+
+}
+
+// *******************************************************************************
+// the neighbour list for fp i has the fp itself at the front, at distance
+// 0.0, and the neighbours in ascending order of distance after that. Each
+// list is only touched by the thread that makes it.
+void make_nnlist( double threshold , const vector<double> &thresholds ,
+                  const vector<pFB> &fps , unsigned int i , NNList &nbs ) {
+
+  nbs.push_back( make_pair( i , 0.0F ) );
+  for( unsigned int j = 0 , js = fps.size() ; j < js ; ++j ) {
+    if( i == j ) {
+      continue;
+    }
+    double dist = fps[i]->calc_distance( *fps[j] , threshold );
+    if( dist < threshold ) {
+      nbs.push_back( make_pair( j , dist_for_nnlist( dist , thresholds ) ) );
+    }
+  }
+  if( nbs.size() > 1 ) {
+    sort( nbs.begin() + 1 , nbs.end() , SortNbsByDist() );
+  }
+
+}
+
+// *******************************************************************************
+void make_nnlist_in_thread( double threshold , const vector<double> &thresholds ,
+                            const vector<pFB> &fps , unsigned int start_num ,
+                            unsigned int nns_start , unsigned int i ,
+                            vector<NNList> &nns ) {
+
+  make_nnlist( threshold , thresholds , fps , start_num + i , nns[nns_start + i] );
+
+}
+
+// *******************************************************************************
+// The lists are made at the largest of the thresholds, using num_threads
+// threads which all share the one copy of the fingerprints.
+void make_nnlists( bool warm_feeling , const vector<double> &thresholds ,
                    unsigned int start_num , unsigned int stop_num ,
-                   const vector<pFB> &fps ,
-                   vector<vector<int> > &nns ) {
+                   int num_threads , const vector<pFB> &fps ,
+                   vector<NNList> &nns ) {
+
+  double threshold = *max_element( thresholds.begin() , thresholds.end() );
 
   stop_num = stop_num > fps.size() ? fps.size() : stop_num;
+  if( stop_num < start_num ) {
+    stop_num = start_num;
+  }
   if( warm_feeling ) {
     cout << "Creating neighbour lists for fps " << start_num
          << " to " << stop_num << endl;
   }
 
-  for( unsigned int i = start_num ; i < stop_num ; ++i ) {
-
-    vector<pair<int,float> > nbs;
-    nbs.push_back( make_pair( i , 0.0F ) );
-    for( unsigned int j = 0 , js = fps.size() ; j < js ; ++j ) {
-      if( i == j ) {
-        continue;
-      }
-      double dist = fps[i]->calc_distance( *fps[j] , threshold );
-      if( dist < threshold ) {
-        nbs.push_back( make_pair( j , dist ) );
-      }
-    }
-    if( nbs.size() > 1 ) {
-      sort( nbs.begin() + 1 , nbs.end() , SortNbsByDist() );
-    }
-    nns.push_back( vector<int>() );
-    transform( nbs.begin() , nbs.end() , back_inserter( nns.back() ) ,
-               bind( &pair<int,float>::first , _1 ) );
-    if( warm_feeling && (i - start_num) && !( ( i-start_num ) % 1000 ) ) {
-      cout << "Generated " << i - start_num << " near-neighbour lists."
-           << endl;
-    }
-
-  }
+  // make room for the new lists first, so the threads can fill them in
+  // without anything moving underneath them.
+  unsigned int nns_start = nns.size();
+  nns.resize( nns_start + stop_num - start_num );
+  DACLIB::parallel_loop( stop_num - start_num , num_threads ,
+                         boost::bind( &make_nnlist_in_thread , threshold ,
+                                      boost::cref( thresholds ) ,
+                                      boost::cref( fps ) , start_num ,
+                                      nns_start , _1 , boost::ref( nns ) ) ,
+                         16 );
 
   if( warm_feeling ) {
     cout << "Generated all " << stop_num - start_num << " near-neighbour lists."
@@ -269,21 +283,20 @@ void check_for_spaces_in_fp_names( bool fix_spaces , vector<string> &fp_names )
 }
 
 // *******************************************************************************
-void make_nnlists( ClusterSettings &cs , unsigned int start_fp ,
-                   unsigned int &num_fps_to_do , vector<string> &fp_names ,
-                   vector<vector<int> > &nns ) {
+// read all the fps from the file, apply the subset if there is one and
+// sort out spaces in the names.
+void read_all_fps( ClusterSettings &cs , const string &filename ,
+                   vector<pFB> &fps ) {
 
   gzFile gzfp;
   bool byteswapping;
-  open_fp_file( cs.input_file() , cs.input_format() , byteswapping , gzfp );
+  open_fp_file( filename , cs.input_format() , byteswapping , gzfp );
 
-  // read all the fps from the file, which we'll need even if we're only
-  // doing a portion of the nnlists
   vector<FingerprintBase *> raw_fps;
   read_fps_from_file( gzfp , byteswapping , cs.input_format() , cs.bitstring_separator() ,
                       0 , numeric_limits<unsigned int>::max() , raw_fps );
+  close_fp_file_for_reading( gzfp );
 
-  vector<pFB> fps;
   fps.reserve( raw_fps.size() );
   for( int i = 0 , is = raw_fps.size() ; i < is ; ++i ) {
     fps.push_back( pFB( raw_fps[i] ) );
@@ -296,6 +309,21 @@ void make_nnlists( ClusterSettings &cs , unsigned int start_fp ,
     check_for_spaces_in_fp_names( cs.fix_spaces_in_names() , fps );
   }
 
+}
+
+// *******************************************************************************
+void read_all_fps( ClusterSettings &cs , vector<pFB> &fps ) {
+
+  read_all_fps( cs , cs.input_file() , fps );
+
+}
+
+// *******************************************************************************
+// fps must be all the fps, even if we're only doing a portion of the nnlists
+void make_nnlists( ClusterSettings &cs , unsigned int start_fp ,
+                   unsigned int &num_fps_to_do , const vector<pFB> &fps ,
+                   vector<NNList> &nns ) {
+
   nns.reserve( fps.size() );
   unsigned int stop_fp = start_fp + num_fps_to_do;
   if( stop_fp > fps.size() ) {
@@ -305,35 +333,154 @@ void make_nnlists( ClusterSettings &cs , unsigned int start_fp ,
     cout << "revised num_fps_to_do to " << num_fps_to_do << endl;
 #endif
   }
-  make_nnlists( cs.warm_feeling() , cs.threshold() , start_fp , stop_fp , fps ,
-                nns );
+  make_nnlists( cs.warm_feeling() , cs.thresholds() , start_fp , stop_fp ,
+                cs.num_threads() , fps , nns );
 
-  // pull the names out of the fingerprints and delete
-  fps_to_name( fps , fp_names );
+}
+
+// *******************************************************************************
+// take the neighbour lists with distances and make the neighbour lists of
+// sequence numbers needed for the clustering, keeping only those neighbours
+// within the threshold.
+void nnlists_at_threshold( double threshold , const vector<NNList> &nn_dists ,
+                           vector<vector<int> > &nns ) {
+
+  // the distances are stored as floats, so compare as floats. See
+  // dist_for_nnlist.
+  float thresh = threshold;
+  nns.clear();
+  nns.reserve( nn_dists.size() );
+  for( int i = 0 , is = nn_dists.size() ; i < is ; ++i ) {
+    nns.push_back( vector<int>() );
+    vector<int> &nn = nns.back();
+    nn.push_back( nn_dists[i].front().first );
+    for( int j = 1 , js = nn_dists[i].size() ; j < js ; ++j ) {
+      if( nn_dists[i][j].second >= thresh ) {
+        break;
+      }
+      nn.push_back( nn_dists[i][j].first );
+    }
+  }
+
+}
+
+// *******************************************************************************
+// read the neighbour lists from a previous run. They need to have been made
+// at a threshold at least as large as the one for this run.
+void read_nnlists_file( ClusterSettings &cs , vector<string> &fp_names ,
+                        vector<NNList> &nns , double &nns_threshold ) {
+
+  gzFile gzfp;
+  bool byteswapping = false;
+  try {
+    open_nnlists_file_for_reading( cs.read_nnlists_file() , nns_threshold ,
+                                   fp_names , byteswapping , gzfp );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( NNListsFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
+
+  if( cs.threshold() > nns_threshold ) {
+    cerr << "Neighbour lists in " << cs.read_nnlists_file()
+         << " were made at threshold " << nns_threshold
+         << " so can't be used for clustering at " << cs.threshold() << "." << endl;
+    cout << "Neighbour lists in " << cs.read_nnlists_file()
+         << " were made at threshold " << nns_threshold
+         << " so can't be used for clustering at " << cs.threshold() << "." << endl;
+    exit( 1 );
+  }
+
+  // the clustering breaks ties on sequence number, so the lists need to be
+  // in fingerprint order, which they might not be in the file.
+  // Every fingerprint must have a list, because make_clusters indexes by
+  // fingerprint number, so a file with one missing is cut short.
+  nns = vector<NNList>( fp_names.size() );
+  int fp_num;
+  NNList nbs;
+  try {
+    while( read_next_nnlist( cs.read_nnlists_file() , gzfp , byteswapping ,
+                             fp_num , nbs ) ) {
+      bool bad_list = fp_num < 0 || fp_num >= int( fp_names.size() ) ||
+          !nns[fp_num].empty();
+      for( unsigned int j = 0 , js = nbs.size() ; j < js ; ++j ) {
+        if( nbs[j].first < 0 || nbs[j].first >= int( fp_names.size() ) ) {
+          bad_list = true;
+        }
+      }
+      if( bad_list ) {
+        cerr << "Bad neighbour list for fingerprint number " << fp_num
+             << " in " << cs.read_nnlists_file() << endl;
+        cout << "Bad neighbour list for fingerprint number " << fp_num
+             << " in " << cs.read_nnlists_file() << endl;
+        exit( 1 );
+      }
+      nns[fp_num].reserve( nbs.size() + 1 );
+      nns[fp_num].push_back( make_pair( fp_num , 0.0F ) );
+      nns[fp_num].insert( nns[fp_num].end() , nbs.begin() , nbs.end() );
+    }
+  } catch( NNListsFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
+  gzclose( gzfp );
 
-#ifdef NOTYET
-  cout << "leaving make_nnlists" << endl;
   for( int i = 0 , is = nns.size() ; i < is ; ++i ) {
-    cout << fp_names[nns[i].front()] << " : ";
-    for( int j = 0 , js = nns[i].size() ; j < js ; ++j ) {
-      cout << nns[i][j] << " ";
+    if( nns[i].empty() ) {
+      cerr << "No neighbour list for fingerprint " << fp_names[i] << " in "
+           << cs.read_nnlists_file() << ", so it might have been cut short."
+           << endl;
+      cout << "No neighbour list for fingerprint " << fp_names[i] << " in "
+           << cs.read_nnlists_file() << ", so it might have been cut short."
+           << endl;
+      exit( 1 );
     }
-    cout << endl;
   }
-#endif
+  if( cs.warm_feeling() ) {
+    cout << "Read " << nns.size() << " neighbour lists made at threshold "
+         << nns_threshold << " from " << cs.read_nnlists_file() << endl;
+  }
+
+}
+
+// *******************************************************************************
+void write_nnlists_file( ClusterSettings &cs , double nns_threshold ,
+                         const vector<string> &fp_names ,
+                         const vector<NNList> &nns ) {
+
+  gzFile gzfp;
+  try {
+    open_nnlists_file_for_writing( cs.write_nnlists_file() , nns_threshold ,
+                                   fp_names , gzfp );
+    for( int i = 0 , is = nns.size() ; i < is ; ++i ) {
+      write_nnlist_with_seed( cs.write_nnlists_file() , gzfp , nns[i] );
+    }
+    close_nnlists_file( cs.write_nnlists_file() , gzfp );
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( NNListsFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
 
 }
 
 // *******************************************************************************
-void make_orig_nn_sizes( unsigned int num_fps , unsigned int start_fp ,
-                         unsigned int num_fps_to_do ,
+void make_orig_nn_sizes( unsigned int num_fps ,
                          const vector<vector<int> > &nns ,
                          vector<int> &orig_nn_sizes ) {
 
   orig_nn_sizes = vector<int>( num_fps , 0 );
-  unsigned int stop_fp = start_fp + num_fps_to_do;
-  for( unsigned int i = start_fp , j = 0 ; i < stop_fp ; ++i , ++j ) {
-    orig_nn_sizes[i] = nns[j].size();
+  for( unsigned int i = 0 , is = nns.size() ; i < is ; ++i ) {
+    orig_nn_sizes[nns[i].front()] = nns[i].size();
   }
 
 }
@@ -364,9 +511,7 @@ int find_next_seed( const vector<vector<int> > &nns ,
 // *******************************************************************************
 void write_cluster( OUTPUT_FORMAT output_format , int clus_num ,
                     const vector<string> &fp_names , const vector<int> &clus ,
-                    int orig_nn_size , ostream &output_stream ,
-                    vector<string> &seed_names ,
-                    vector<string> &singleton_names ) {
+                    int orig_nn_size , ostream &output_stream ) {
 
   switch( output_format ) {
   case SAMPLES_FORMAT :
@@ -391,10 +536,39 @@ void write_cluster( OUTPUT_FORMAT output_format , int clus_num ,
     break;
   }
 
-  seed_names.push_back( fp_names[clus.front()] );
-  if( 1 == clus.size() ) {
-    singleton_names.push_back( fp_names[clus.front()] );
+}
+
+// *******************************************************************************
+void write_clusters( ClusterSettings &cs , const string &output_file ,
+                     const vector<string> &fp_names ,
+                     const vector<vector<int> > &clusters ,
+                     const vector<int> &clus_orig_nn_sizes ) {
+
+  ofstream output_stream( output_file.c_str() );
+  if( SAMPLES_FORMAT == cs.output_format() ) {
+    output_stream << "Molecule name : Cluster size : Cluster Members" << endl;
+  }
+
+  for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
+    write_cluster( cs.output_format() , i + 1 , fp_names , clusters[i] ,
+                   clus_orig_nn_sizes[i] , output_stream );
+  }
+
+}
+
+// *******************************************************************************
+void report_clusters( int num_fps , int num_clusters ) {
+
+  string fp_out = " fingerprint";
+  if( num_fps > 1 ) {
+    fp_out += "s";
   }
+  string clus_out = " cluster";
+  if( num_clusters > 1 ) {
+    clus_out += "s";
+  }
+  cout << "Clustered " << num_fps << fp_out << " into "
+       << num_clusters << clus_out << "." << endl;
 
 }
 
@@ -440,736 +614,1530 @@ void remove_cluster_from_nns( unsigned int num_fps , const vector<int> &cluster
 }
 
 // *******************************************************************************
-// do the clustering and output as we go
-void output_clusters( bool warm_feeling , vector<string> &fp_names ,
-                      vector<vector<int> > &nns , OUTPUT_FORMAT output_format ,
-                      ostream &output_stream , vector<string> &seed_names ,
-                      vector<string> &singleton_names ) {
-
-  if( SAMPLES_FORMAT == output_format ) {
-    output_stream << "Molecule name : Cluster size : Cluster Members" << endl;
-  }
+// do the clustering, returning the clusters in the order they were formed,
+// each with the seed at the front, and the original neighbour list sizes of
+// the seeds.
+void make_clusters( bool warm_feeling , unsigned int num_fps ,
+                    vector<vector<int> > &nns ,
+                    vector<vector<int> > &clusters ,
+                    vector<int> &clus_orig_nn_sizes ) {
 
   vector<int> orig_nn_sizes( nns.size() , -1 );
   for( int i = 0 , is = nns.size() ; i < is ; ++i ) {
     orig_nn_sizes[i] = nns[i].size();
   }
 
-  int num_written = 0 , tot = 0;
+  int tot = 0;
   while( !nns.empty() ) {
 
     int next_seed_num = find_next_seed( nns , orig_nn_sizes );
 
-    write_cluster( output_format , num_written + 1 , fp_names ,
-                   nns[next_seed_num] ,
-                   orig_nn_sizes[nns[next_seed_num].front()] , output_stream ,
-        seed_names , singleton_names );
-    ++num_written;
-    tot += nns[next_seed_num].size();
-    vector<int> cluster( nns[next_seed_num] );
-    remove_cluster_from_nns( fp_names.size() , cluster , nns );
+    clusters.push_back( nns[next_seed_num] );
+    clus_orig_nn_sizes.push_back( orig_nn_sizes[nns[next_seed_num].front()] );
+    tot += clusters.back().size();
+    remove_cluster_from_nns( num_fps , clusters.back() , nns );
 
-    if( warm_feeling && !( num_written % 100 ) ) {
-      cout << "Written " << num_written << " clusters, average size "
-           << tot / num_written << "." << endl;
+    if( warm_feeling && !( clusters.size() % 100 ) ) {
+      cout << "Made " << clusters.size() << " clusters, average size "
+           << tot / clusters.size() << "." << endl;
     }
   }
 
-  string fp_out = " fingerprint";
-  if( fp_names.size() > 1 ) {
-    fp_out += "s";
-  }
-  string clus_out = " cluster";
-  if( num_written > 1 ) {
-    clus_out += "s";
-  }
-  cout << "Clustered " << fp_names.size() << fp_out << " into "
-       << num_written << clus_out << "." << endl;
+  report_clusters( num_fps , clusters.size() );
 
 }
 
 // *******************************************************************************
-void serial_run( ClusterSettings &cs , vector<string> &seed_names ,
-                 vector<string> &singleton_names ) {
-
-  // open the output stream right away, in case we can't. It's best to find
-  // out before we've done a potentially long job.
-  ofstream output_stream( cs.output_file().c_str() );
-  if( !output_stream.good() ) {
-    cerr << "Couldn't open " << cs.output_file() << " for writing." << endl;
-    exit( 1 );
+// open the output streams right away, in case we can't. It's best to find
+// out before we've done a potentially long job. They're opened again when
+// they're needed.
+void check_output_files( ClusterSettings &cs ) {
+
+  for( unsigned int i = 0 ; i < cs.thresholds().size() ; ++i ) {
+    string output_file = cs.output_file( cs.thresholds()[i] );
+    ofstream output_stream( output_file.c_str() );
+    if( !output_stream.good() ) {
+      cerr << "Couldn't open " << output_file << " for writing." << endl;
+      exit( 1 );
+    }
+  }
+  // the neighbour lists file is opened for appending, as it might also be
+  // the one being read
+  if( !cs.write_nnlists_file().empty() ) {
+    ofstream nnlists_stream( cs.write_nnlists_file().c_str() , ios::app );
+    if( !nnlists_stream.good() ) {
+      cerr << "Couldn't open " << cs.write_nnlists_file() << " for writing." << endl;
+      exit( 1 );
+    }
   }
-
-  vector<vector<int> > nns;
-  vector<string> fp_names;
-
-  unsigned num_fps_to_do = numeric_limits<unsigned int>::max();
-  make_nnlists( cs , 0 , num_fps_to_do , fp_names , nns );
-  output_clusters( cs.warm_feeling() , fp_names , nns , cs.output_format() ,
-                   output_stream , seed_names , singleton_names );
 
 }
 
 // *******************************************************************************
-void send_cluster_to_master( const vector<vector<int> > &nnlists ) {
-
-
-  int clus_num;
-  MPI_Recv( &clus_num , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-
-  unsigned int i = nnlists[clus_num].size();
-  MPI_Send( &i , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
-  MPI_Send( const_cast<int *>( &(nnlists[clus_num])[0] ) , i , MPI_INT , 0 , 0 , MPI_COMM_WORLD );
+// The Tanimoto distance between fingerprints with a and b bits set can't be
+// less than 1 - min(a,b)/max(a,b), so only fingerprints with bit counts
+// in this range can be within threshold of one with num_bits set.  The range
+// is a bit generous at both ends, calc_distance makes the final decision.
+void bit_count_range( int num_bits , double threshold , int &min_bits ,
+                      int &max_bits ) {
+
+  min_bits = int( floor( num_bits * ( 1.0 - threshold ) ) ) - 1;
+  double max_d = threshold < 1.0 ?
+      ceil( num_bits / ( 1.0 - threshold ) ) + 1.0 : numeric_limits<double>::max();
+  max_bits = max_d < double( numeric_limits<int>::max() ) ?
+      int( max_d ) : numeric_limits<int>::max();
 
 }
 
 // *******************************************************************************
-void send_best_cluster_details_to_master( const vector<vector<int> > &nnlists ,
-                                          const vector<int> &orig_nn_sizes ) {
-
-#ifdef NOTYET
-  int world_rank;
-  MPI_Comm_rank( MPI_COMM_WORLD , &world_rank );
-  cout << "send_best_cluster_details_to_master for " << world_rank << endl;
-#endif
-
-  if( nnlists.empty() ) {
-    int i = -1;
-    MPI_Send( &i , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
-    return;
+// all the seeds within threshold of singleton, sorted into ascending order
+// of distance then seed number.  seed_bits is the seeds' bit counts and
+// sequence numbers, in ascending order.
+void find_seeds_near_singleton( const vector<pFB> &fps ,
+                                const vector<pair<int,int> > &seed_bits ,
+                                const vector<int> &singletons ,
+                                double threshold , unsigned int i ,
+                                vector<vector<pair<double,int> > > &near_seeds ) {
+
+  int sing = singletons[i];
+  int min_bits , max_bits;
+  bit_count_range( fps[sing]->count_bits() , threshold , min_bits , max_bits );
+  vector<pair<int,int> >::const_iterator p =
+      lower_bound( seed_bits.begin() , seed_bits.end() , make_pair( min_bits , -1 ) );
+  for( ; p != seed_bits.end() && p->first <= max_bits ; ++p ) {
+    if( p->second == sing ) {
+      continue;
+    }
+    double dist = fps[p->second]->calc_distance( *fps[sing] , threshold );
+    if( dist < threshold ) {
+      near_seeds[i].push_back( make_pair( dist , p->second ) );
+    }
   }
-
-  int best_clus = find_next_seed( nnlists , orig_nn_sizes );
-  MPI_Send( &best_clus , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD );
-
-  // send the size, the original size and the first member in one go
-  unsigned int best_clus_details[3];
-  best_clus_details[0] = nnlists[best_clus].size();
-  best_clus_details[1] = orig_nn_sizes[nnlists[best_clus].front()];
-  best_clus_details[2] = nnlists[best_clus].front();
-  MPI_Send( &best_clus_details , 3 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
+  sort( near_seeds[i].begin() , near_seeds[i].end() );
 
 }
 
 // *******************************************************************************
-void send_best_cluster_to_master( const vector<vector<int> > &nnlists ,
-                                  const vector<int> &orig_nn_sizes ) {
+// put each singleton into the cluster whose seed it is nearest to, within
+// cs.singletons_threshold().  The singletons are taken in order, and a
+// singleton that has been put into a cluster is no longer a seed, and one
+// that has had a singleton put into it is no longer a singleton. Finding the
+// seeds near each singleton is the expensive part, and doesn't depend on
+// the ones before, so that's done up front in parallel, then the
+// assignments are made in order from the lists.
+void collapse_singletons( ClusterSettings &cs , const vector<pFB> &fps ,
+                          vector<vector<int> > &clusters ,
+                          vector<int> &clus_orig_nn_sizes ) {
+
+  vector<int> singletons;
+  vector<pair<int,int> > seed_bits;
+  vector<char> is_singleton( fps.size() , 0 );
+  for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
+    int seed = clusters[i].front();
+    // count_bits() may cache the count, so call it before the threads start
+    seed_bits.push_back( make_pair( fps[seed]->count_bits() , seed ) );
+    if( 1 == clusters[i].size() ) {
+      singletons.push_back( seed );
+      is_singleton[seed] = 1;
+    }
+  }
+  sort( singletons.begin() , singletons.end() );
+  sort( seed_bits.begin() , seed_bits.end() );
 
-  if( nnlists.empty() ) {
-    int i = -1;
-    MPI_Send( &i , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
-    return;
+  if( cs.warm_feeling() ) {
+    cout << "Collapse_singletons at " << cs.singletons_threshold() << "." << endl;
+    if( 1 == singletons.size() ) {
+      cout << "There is 1 singleton";
+    } else {
+      cout << "There are " << singletons.size() << " singletons";
+    }
+    cout << " to slot into " << clusters.size() << " cluster";
+    if( clusters.size() > 1 ) {
+      cout << "s";
+    }
+    cout << "." << endl;
   }
 
-  int best_clus = find_next_seed( nnlists , orig_nn_sizes );
-  int i = nnlists[best_clus].size();
-  MPI_Send( &i , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
-  MPI_Send( const_cast<int *>( &nnlists[best_clus][0] ) , i , MPI_INT , 0 , 0 , MPI_COMM_WORLD );
-  i = orig_nn_sizes[nnlists[best_clus][0]];
-  MPI_Send( &i , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
+  vector<vector<pair<double,int> > > near_seeds( singletons.size() );
+  DACLIB::parallel_loop( singletons.size() , cs.num_threads() ,
+                         boost::bind( &find_seeds_near_singleton ,
+                                      boost::cref( fps ) , boost::cref( seed_bits ) ,
+                                      boost::cref( singletons ) ,
+                                      cs.singletons_threshold() , _1 ,
+                                      boost::ref( near_seeds ) ) );
 
-#ifdef NOTYET
-  cout << "sending best_clus : " << best_clus << " size " << nnlists[best_clus].size()
-       << " orig nn size : " << i << endl;
-#endif
+  vector<char> seed_gone( fps.size() , 0 );
+  vector<vector<int> > new_members( fps.size() );
+  for( int i = 0 , is = singletons.size() ; i < is ; ++i ) {
+    int sing = singletons[i];
+    if( !is_singleton[sing] ) {
+      continue; // it might have been promoted by now
+    }
+    for( int j = 0 , js = near_seeds[i].size() ; j < js ; ++j ) {
+      int seed = near_seeds[i][j].second;
+      if( seed_gone[seed] ) {
+        continue;
+      }
+      if( cs.warm_feeling() ) {
+        cout << "Singleton " << fps[sing]->get_name() << " goes into cluster of "
+             << fps[seed]->get_name() << " at distance " << near_seeds[i][j].first << endl;
+      }
+      new_members[seed].push_back( sing );
+      seed_gone[sing] = 1;
+      is_singleton[seed] = 0;
+      break;
+    }
+    vector<pair<double,int> >().swap( near_seeds[i] );
+  }
+
+  // the singletons that have gone into other clusters no longer have
+  // clusters of their own
+  vector<vector<int> > new_clusters;
+  vector<int> new_orig_nn_sizes;
+  for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
+    int seed = clusters[i].front();
+    if( seed_gone[seed] ) {
+      continue;
+    }
+    new_clusters.push_back( clusters[i] );
+    new_clusters.back().insert( new_clusters.back().end() ,
+                                new_members[seed].begin() ,
+                                new_members[seed].end() );
+    new_orig_nn_sizes.push_back( clus_orig_nn_sizes[i] );
+  }
+  clusters.swap( new_clusters );
+  clus_orig_nn_sizes.swap( new_orig_nn_sizes );
 
 }
 
 // *******************************************************************************
-void cross_off_cluster( unsigned int num_fps ,
-                        vector<vector<int> > &nnlists ) {
+bool collapsing_singletons( ClusterSettings &cs ) {
 
-  int clus_size = 0;
-  MPI_Recv( &clus_size , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  vector<int> cluster( clus_size , -1 );
-  MPI_Recv( &cluster[0] , clus_size , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-
-  remove_cluster_from_nns( num_fps , cluster , nnlists );
+  const vector<double> &thresholds = cs.thresholds();
+  return cs.singletons_threshold() >
+      *min_element( thresholds.begin() , thresholds.end() );
 
 }
 
 // *******************************************************************************
-void receive_best_clusters_from_slaves( int world_size ,
-                                        vector<int> &cluster , int &orig_nn_size ) {
-
-  for( int i = 1 ; i < world_size ; ++i ) {
-    DACLIB::mpi_send_string( string( "Send_Best_Cluster_Details" ) , i );
+// fps from the fingerprint file for collapsing singletons, when the
+// neighbour lists came from a file. They must be the same fps.
+void read_fps_for_nnlists( ClusterSettings &cs , const vector<string> &fp_names ,
+                           vector<pFB> &fps ) {
+
+  read_all_fps( cs , fps );
+  bool ok = fps.size() == fp_names.size();
+  for( unsigned int i = 0 ; ok && i < fps.size() ; ++i ) {
+    ok = fps[i]->get_name() == fp_names[i];
+  }
+  if( !ok ) {
+    cerr << "Fingerprints in " << cs.input_file()
+         << " don't match those in neighbour lists file "
+         << cs.read_nnlists_file() << "." << endl;
+    cout << "Fingerprints in " << cs.input_file()
+         << " don't match those in neighbour lists file "
+         << cs.read_nnlists_file() << "." << endl;
+    exit( 1 );
   }
 
-  int best_clus = -1 , best_clus_slave = 0;
-  unsigned int best_clus_size = 0 , best_orig_nn_size = 0 , best_clus_front = 0;
-
-  int num_to_report = 0;
-  int num_slaves = world_size - 1; // process 0 is the master
+}
 
-  while( num_to_report < num_slaves ) {
+// *******************************************************************************
+// Incremental clustering.  The fingerprints in cs.add_fps_file() go after
+// those the neighbour lists file was made from, as if the 2 files had been
+// joined.  Only the distances from the new fingerprints to all the others
+// are calculated, and each new fingerprint's old neighbours get it added to
+// their lists, so the lists are the same as a full run on the joined files
+// would make.  The new lists are made at the threshold the file was made at,
+// so the merged lists can be written out and added to again.
+void add_fps_to_nnlists( ClusterSettings &cs , double nns_threshold ,
+                         vector<string> &fp_names , vector<NNList> &nn_dists ,
+                         vector<pFB> &fps ) {
+
+  read_fps_for_nnlists( cs , fp_names , fps );
+  if( nn_dists.size() != fp_names.size() ) {
+    cerr << "Neighbour lists file " << cs.read_nnlists_file()
+         << " doesn't have a list for every fingerprint." << endl;
+    cout << "Neighbour lists file " << cs.read_nnlists_file()
+         << " doesn't have a list for every fingerprint." << endl;
+    exit( 1 );
+  }
 
-    MPI_Status status;
-    MPI_Probe( MPI_ANY_SOURCE , 0 , MPI_COMM_WORLD , &status );
-    int this_best_clus;
-    MPI_Recv( &this_best_clus , 1 , MPI_INT , status.MPI_SOURCE , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    ++num_to_report;
-#ifdef NOTYET
-    cout << "slave " << status.MPI_SOURCE << " reports this_best_clus = " << this_best_clus << endl;
-#endif
-    if( -1 == this_best_clus ) {
-      continue; // this slave has no more nnlists
-    }
-    unsigned int this_best_clus_details[3];
-    MPI_Recv( &this_best_clus_details , 3 , MPI_UNSIGNED , status.MPI_SOURCE , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-#ifdef NOTYET
-    cout << "details : " << this_best_clus_details[0]
-            << " : " << this_best_clus_details[1] << " : " << this_best_clus_details[2] << endl;
-#endif
-    // this_best_clus_details contains, in order, the size of the best cluster
-    // on slave i, the orginal nnlists size of that cluster, and the first
-    // member of the cluster.
-    if( this_best_clus_details[0] > best_clus_size ) {
-      best_clus_size = this_best_clus_details[0];
-      best_orig_nn_size = this_best_clus_details[1];
-      best_clus_front = this_best_clus_details[2];
-      best_clus = this_best_clus;
-      best_clus_slave = status.MPI_SOURCE;
-    } else if( this_best_clus_details[0] == best_clus_size ) {
-      if( this_best_clus_details[1] > best_orig_nn_size ) {
-        best_orig_nn_size = this_best_clus_details[1];
-        best_clus_front = this_best_clus_details[2];
-        best_clus = this_best_clus;
-        best_clus_slave = status.MPI_SOURCE;
-      } else if( this_best_clus_details[1] == best_orig_nn_size ) {
-        if( this_best_clus_details[2] > best_clus_front ) {
-          best_clus_front = this_best_clus_details[2];
-          best_clus = this_best_clus;
-          best_clus_slave = status.MPI_SOURCE;
-        }
+  vector<pFB> new_fps;
+  read_all_fps( cs , cs.add_fps_file() , new_fps );
+  unsigned int num_old_fps = fps.size();
+  fps.insert( fps.end() , new_fps.begin() , new_fps.end() );
+  fps_to_name( new_fps , fp_names );
+
+  // the largest threshold is the one the lists are made at
+  vector<double> thresholds( cs.thresholds() );
+  thresholds.push_back( nns_threshold );
+  make_nnlists( cs.warm_feeling() , thresholds , num_old_fps , fps.size() ,
+                cs.num_threads() , fps , nn_dists );
+
+  // the distances are symmetrical, so the old fps' new neighbours come from
+  // the new fps' lists
+  vector<char> changed( num_old_fps , 0 );
+  for( unsigned int i = num_old_fps , is = fps.size() ; i < is ; ++i ) {
+    const NNList &nbs = nn_dists[i];
+    for( unsigned int j = 1 , js = nbs.size() ; j < js ; ++j ) {
+      if( nbs[j].first < int( num_old_fps ) ) {
+        nn_dists[nbs[j].first].push_back( make_pair( int( i ) , nbs[j].second ) );
+        changed[nbs[j].first] = 1;
       }
     }
   }
-
-#ifdef NOTYET
-  cout << "best_clus = " << best_clus << endl;
-#endif
-
-  if( -1 == best_clus ) {
-    // we're done, flag it as such
-    cluster.clear();
-    orig_nn_size = 0;
-  } else {
-    // need to get the best cluster off the appropriate slave
-    DACLIB::mpi_send_string( string( "Send_Cluster" ) , best_clus_slave );
-    MPI_Send( &best_clus , 1 , MPI_INT , best_clus_slave , 0 , MPI_COMM_WORLD );
-
-    cluster.resize( best_clus_size );
-    unsigned int clus_size;
-    MPI_Recv( &clus_size , 1 , MPI_UNSIGNED , best_clus_slave , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    if( clus_size != best_clus_size ) {
-      cerr << "AWOOGA - slave " << best_clus_slave
-           << " has sent the wrong cluster. It's clearly messed up, so we're done."
-           << endl;
-      MPI_Finalize();
-      exit( 1 );
+  for( unsigned int i = 0 ; i < num_old_fps ; ++i ) {
+    if( changed[i] ) {
+      sort( nn_dists[i].begin() + 1 , nn_dists[i].end() , SortNbsByDist() );
     }
-    MPI_Recv( &cluster[0] , clus_size , MPI_INT , best_clus_slave , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    orig_nn_size = best_orig_nn_size;
+  }
+
+  if( cs.warm_feeling() ) {
+    cout << "Added " << new_fps.size() << " fingerprints from "
+         << cs.add_fps_file() << " to the neighbour lists, giving "
+         << fps.size() << " in all." << endl;
   }
 
 }
 
 // *******************************************************************************
-void tell_slaves_to_cross_off_cluster( int world_size ,
-                                       const vector<int> &cluster ) {
-
-  for( int i = 1 ; i < world_size ; ++i ) {
-    DACLIB::mpi_send_string( string( "Cross_Off_Cluster" ) , i );
+// collapse the singletons if required and write the clusters
+void finish_clusters( ClusterSettings &cs , double threshold ,
+                      const vector<pFB> &fps , const vector<string> &fp_names ,
+                      vector<vector<int> > &clusters ,
+                      vector<int> &clus_orig_nn_sizes ) {
 
-    int j = cluster.size();
-    MPI_Send( &j , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD );
-    MPI_Send( const_cast<int *>( &cluster[0] ) , j , MPI_INT , i , 0 , MPI_COMM_WORLD );
+  if( cs.singletons_threshold() > threshold ) {
+    collapse_singletons( cs , fps , clusters , clus_orig_nn_sizes );
   }
+  write_clusters( cs , cs.output_file( threshold ) , fp_names , clusters ,
+                  clus_orig_nn_sizes );
 
 }
 
 // *******************************************************************************
-void send_search_details( ClusterSettings &cs , unsigned int num_fps ,
-                          int world_size , unsigned int &slave_does ) {
-
-  // each slave needs to do something like num_fps / num_procs fps
-  // each against all targets
-  slave_does = num_fps / ( world_size - 1 );
-  while( slave_does * ( world_size - 1 ) < num_fps ) {
-    ++slave_does;
-  }
-  if( cs.warm_feeling() ) {
-    cout << "Each slave does " << slave_does << " fps " << endl;
+// Jarvis-Patrick clustering, from the same neighbour lists.  Two fps go in
+// the same cluster if each is in the other's nearest cs.jp_num_neighbours()
+// neighbours within the threshold, and those nearest neighbours have at
+// least cs.jp_min_common() fps in common.  The clusters are the connected
+// sets of fps made by these links.
+// nearest has the nearest neighbours of each fp in ascending order of
+// sequence number, for binary_search and counting the common ones.
+void jp_nearest_neighbours( int num_nbs , double threshold , unsigned int num_fps ,
+                            const vector<NNList> &nn_dists ,
+                            vector<vector<int> > &nearest ) {
+
+  // the distances are stored as floats, so compare as floats. See
+  // dist_for_nnlist.
+  float thresh = threshold;
+  nearest = vector<vector<int> >( num_fps );
+  for( int i = 0 , is = nn_dists.size() ; i < is ; ++i ) {
+    vector<int> &near = nearest[nn_dists[i].front().first];
+    for( int j = 1 , js = nn_dists[i].size() ; j < js && j <= num_nbs ; ++j ) {
+      if( nn_dists[i][j].second >= thresh ) {
+        break;
+      }
+      near.push_back( nn_dists[i][j].first );
+    }
+    sort( near.begin() , near.end() );
   }
 
-  for( int i = 1 ; i < world_size ; ++i ) {
-
-    DACLIB::mpi_send_string( string( "Search_Details" ) , i );
-    cs.send_contents_via_mpi( i );
-    // send the number of fps each slave must do, and the slave number,
-    // so it knows where to start
-    MPI_Send( &slave_does , 1 , MPI_UNSIGNED , i , 0 , MPI_COMM_WORLD );
-    MPI_Send( &i , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD );
+}
 
+// *******************************************************************************
+// the fps after i that i should be in the same cluster as
+void jp_links( const vector<vector<int> > &nearest , int min_common ,
+               unsigned int i , vector<vector<int> > &links ) {
+
+  const vector<int> &near_i = nearest[i];
+  for( int j = 0 , js = near_i.size() ; j < js ; ++j ) {
+    int nb = near_i[j];
+    if( nb < int( i ) ) {
+      continue;
+    }
+    const vector<int> &near_nb = nearest[nb];
+    if( !binary_search( near_nb.begin() , near_nb.end() , int( i ) ) ) {
+      continue;
+    }
+    int num_common = 0;
+    vector<int>::const_iterator p = near_i.begin() , q = near_nb.begin();
+    while( p != near_i.end() && q != near_nb.end() ) {
+      if( *p < *q ) {
+        ++p;
+      } else if( *q < *p ) {
+        ++q;
+      } else {
+        ++num_common;
+        ++p;
+        ++q;
+      }
+    }
+    if( num_common >= min_common ) {
+      links[i].push_back( nb );
+    }
   }
 
 }
 
 // *******************************************************************************
-void receive_search_details( ClusterSettings &cs , unsigned int &num_fps_to_do ,
-                             unsigned int &start_fp ) {
+int jp_root( vector<int> &parents , int i ) {
 
-  cs.receive_contents_via_mpi();
-  MPI_Recv( &num_fps_to_do , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  int slave_rank;
-  MPI_Recv( &slave_rank , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  --slave_rank; // first slave has rank 1.
-  start_fp = slave_rank * num_fps_to_do;
-
-  if( cs.warm_feeling() ) {
-    cout << "This slave to do " << num_fps_to_do << " nnlists, starting at fp "
-         << start_fp << endl;
+  while( parents[i] != i ) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
   }
+  return i;
 
 }
 
-// ********************************************************************
-void send_cwd_to_slaves( int world_size ) {
+// *******************************************************************************
+// The seed of each cluster is the member with the largest neighbour list
+// within the threshold, which is also the original neighbour list size
+// reported.  The members in the seed's neighbour list come after it, in
+// ascending order of distance, then the rest in input order.  The clusters
+// are biggest first.
+void jarvis_patrick_clusters( ClusterSettings &cs , double threshold ,
+                              unsigned int num_fps , const vector<NNList> &nn_dists ,
+                              vector<vector<int> > &clusters ,
+                              vector<int> &clus_orig_nn_sizes ) {
+
+  vector<vector<int> > nearest;
+  jp_nearest_neighbours( cs.jp_num_neighbours() , threshold , num_fps ,
+                         nn_dists , nearest );
+  // finding the links is the expensive bit, so that's done in parallel.
+  vector<vector<int> > links( num_fps );
+  DACLIB::parallel_loop( num_fps , cs.num_threads() ,
+                         boost::bind( &jp_links , boost::cref( nearest ) ,
+                                      cs.jp_min_common() , _1 ,
+                                      boost::ref( links ) ) );
+  vector<vector<int> >().swap( nearest );
+
+  // union-find, with the lowest sequence number the root of each set
+  vector<int> parents( num_fps );
+  for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+    parents[i] = i;
+  }
+  for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+    for( int j = 0 , js = links[i].size() ; j < js ; ++j ) {
+      int root_i = jp_root( parents , i );
+      int root_j = jp_root( parents , links[i][j] );
+      if( root_i < root_j ) {
+        parents[root_j] = root_i;
+      } else if( root_j < root_i ) {
+        parents[root_i] = root_j;
+      }
+    }
+  }
+  vector<vector<int> >().swap( links );
 
-  string cwd = DACLIB::get_cwd();
-  if( cwd.length() ) {
-    // process 0 is the master
-    for( int i = 1 ; i < world_size ; ++i ) {
-      DACLIB::mpi_send_string( string( "New_CWD" ) , i );
-      DACLIB::mpi_send_string( cwd , i );
+  vector<vector<int> > members( num_fps );
+  for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+    members[jp_root( parents , i )].push_back( i );
+  }
+
+  float thresh = threshold;
+  vector<int> nn_sizes( num_fps , 0 ) , nnl_pos( num_fps , -1 );
+  for( int i = 0 , is = nn_dists.size() ; i < is ; ++i ) {
+    int fp_num = nn_dists[i].front().first;
+    nnl_pos[fp_num] = i;
+    nn_sizes[fp_num] = 1;
+    for( int j = 1 , js = nn_dists[i].size() ; j < js ; ++j ) {
+      if( nn_dists[i][j].second >= thresh ) {
+        break;
+      }
+      ++nn_sizes[fp_num];
+    }
+  }
+
+  vector<pair<int,int> > clus_order;
+  for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+    if( !members[i].empty() ) {
+      clus_order.push_back( make_pair( -int( members[i].size() ) , i ) );
     }
   }
+  sort( clus_order.begin() , clus_order.end() );
+
+  vector<char> in_cluster( num_fps , 0 );
+  clusters.reserve( clus_order.size() );
+  clus_orig_nn_sizes.reserve( clus_order.size() );
+  for( int i = 0 , is = clus_order.size() ; i < is ; ++i ) {
+    int root = clus_order[i].second;
+    const vector<int> &mems = members[root];
+    int seed = mems.front();
+    for( int j = 1 , js = mems.size() ; j < js ; ++j ) {
+      if( nn_sizes[mems[j]] > nn_sizes[seed] ) {
+        seed = mems[j];
+      }
+    }
+    clusters.push_back( vector<int>( 1 , seed ) );
+    vector<int> &clus = clusters.back();
+    in_cluster[seed] = 1;
+    if( -1 != nnl_pos[seed] ) {
+      const NNList &nnl = nn_dists[nnl_pos[seed]];
+      for( int j = 1 , js = nnl.size() ; j < js ; ++j ) {
+        int nb = nnl[j].first;
+        if( !in_cluster[nb] && root == jp_root( parents , nb ) ) {
+          clus.push_back( nb );
+          in_cluster[nb] = 1;
+        }
+      }
+    }
+    for( int j = 0 , js = mems.size() ; j < js ; ++j ) {
+      if( !in_cluster[mems[j]] ) {
+        clus.push_back( mems[j] );
+        in_cluster[mems[j]] = 1;
+      }
+    }
+    clus_orig_nn_sizes.push_back( nn_sizes[seed] );
+  }
+
+  report_clusters( num_fps , clusters.size() );
 
 }
 
 // *******************************************************************************
-void tell_master_slave_has_done_nnlists() {
+void serial_run( ClusterSettings &cs ) {
 
-  DACLIB::mpi_send_string( string( "NNLists_Done" ) , 0 );
+  check_output_files( cs );
+
+  vector<NNList> nn_dists;
+  vector<string> fp_names;
+  vector<pFB> fps; // kept for collapsing singletons
+  double nns_threshold = cs.threshold();
+
+  if( cs.read_nnlists_file().empty() ) {
+    read_all_fps( cs , fps );
+    unsigned num_fps_to_do = numeric_limits<unsigned int>::max();
+    make_nnlists( cs , 0 , num_fps_to_do , fps , nn_dists );
+    fps_to_name( fps , fp_names );
+    if( !collapsing_singletons( cs ) ) {
+      fps.clear();
+    }
+  } else {
+    read_nnlists_file( cs , fp_names , nn_dists , nns_threshold );
+    if( !cs.add_fps_file().empty() ) {
+      add_fps_to_nnlists( cs , nns_threshold , fp_names , nn_dists , fps );
+      if( !collapsing_singletons( cs ) ) {
+        fps.clear();
+      }
+    } else if( collapsing_singletons( cs ) ) {
+      read_fps_for_nnlists( cs , fp_names , fps );
+    }
+  }
+  if( !cs.write_nnlists_file().empty() ) {
+    write_nnlists_file( cs , nns_threshold , fp_names , nn_dists );
+  }
+
+  // all the thresholds are done from the one set of neighbour lists
+  const vector<double> &thresholds = cs.thresholds();
+  for( unsigned int i = 0 ; i < thresholds.size() ; ++i ) {
+    if( cs.warm_feeling() && thresholds.size() > 1 ) {
+      cout << "Clustering at threshold " << thresholds[i] << " into "
+           << cs.output_file( thresholds[i] ) << endl;
+    }
+    vector<vector<int> > clusters;
+    vector<int> clus_orig_nn_sizes;
+    if( JARVIS_PATRICK == cs.algorithm() ) {
+      jarvis_patrick_clusters( cs , thresholds[i] , fp_names.size() , nn_dists ,
+                               clusters , clus_orig_nn_sizes );
+    } else {
+      vector<vector<int> > nns;
+      nnlists_at_threshold( thresholds[i] , nn_dists , nns );
+      if( 1 == thresholds.size() ) {
+        vector<NNList>().swap( nn_dists );
+      }
+      make_clusters( cs.warm_feeling() , fp_names.size() , nns , clusters ,
+                     clus_orig_nn_sizes );
+    }
+    finish_clusters( cs , thresholds[i] , fps , fp_names , clusters ,
+                     clus_orig_nn_sizes );
+  }
 
 }
 
 // *******************************************************************************
-void parallel_run( ClusterSettings &cs , int world_size ,
-                   vector<string> &seed_names ,
-                   vector<string> &singleton_names ) {
+// Leader clustering.  The fingerprint file is read once, in batches, and
+// each fingerprint goes into the cluster of the nearest leader within the
+// threshold, or becomes a new leader if there isn't one.  Only the leaders'
+// fingerprints are kept, indexed by bit count so that only those that might
+// be within the threshold are looked at.  Each batch is done in two goes. The
+// leaders from before the batch are searched in parallel, then the batch is
+// taken in order to look at the leaders made earlier in the batch and to make
+// the new ones, so the clusters are the same whatever the number of threads.
+static const unsigned int LEADER_BATCH_SIZE = 10000;
 
-  // open the output stream right away, in case we can't. It's best to find
-  // out before we've done a potentially long job.
-  ofstream output_stream( cs.output_file().c_str() );
-  if( !output_stream.good() ) {
-    cerr << "Couldn't open " << cs.output_file() << " for writing." << endl;
-    exit( 1 );
-  }
-  if( SAMPLES_FORMAT == cs.output_format() ) {
-    output_stream << "Molecule name : Cluster size : Cluster Members" << endl;
+// *******************************************************************************
+// leaders first_leader to last_leader - 1, looked for via leader_buckets,
+// which has the leader numbers by bit count.  best_leader and best_dist are
+// only changed if a leader is found that is nearer than best_dist, or the
+// same distance and an earlier leader.
+void nearest_leader( const vector<pFB> &leader_fps ,
+                     const vector<vector<int> > &leader_buckets ,
+                     int first_leader , int last_leader ,
+                     const FingerprintBase &fp , double threshold ,
+                     int &best_leader , double &best_dist ) {
+
+  int min_bits , max_bits;
+  bit_count_range( fp.count_bits() , threshold , min_bits , max_bits );
+  min_bits = min_bits < 0 ? 0 : min_bits;
+  max_bits = max_bits >= int( leader_buckets.size() ) ? int( leader_buckets.size() ) - 1 : max_bits;
+  for( int i = min_bits ; i <= max_bits ; ++i ) {
+    const vector<int> &bucket = leader_buckets[i];
+    // leader numbers go into the buckets in ascending order
+    vector<int>::const_iterator p = lower_bound( bucket.begin() , bucket.end() ,
+                                                 first_leader );
+    for( ; p != bucket.end() && *p < last_leader ; ++p ) {
+      double dist = leader_fps[*p]->calc_distance( fp , threshold );
+      if( dist < threshold &&
+          ( -1 == best_leader || dist < best_dist ||
+            ( dist == best_dist && *p < best_leader ) ) ) {
+        best_leader = *p;
+        best_dist = dist;
+      }
+    }
   }
 
-  unsigned int num_fps = 0;
-  try {
-    num_fps = count_fps_in_file( cs.input_file() , cs.input_format() ,
-                                 cs.bitstring_separator() );
-  } catch( DACLIB::FileReadOpenError &e ) {
-    cerr << e.what() << endl;
-    cout << e.what() << endl;
-    exit( 1 );
-  } catch( FingerprintFileError &e ) {
-    cerr << e.what() << endl;
-    cout << e.what() << endl;
-    exit( 1 );
+}
+
+// *******************************************************************************
+void nearest_old_leader( const vector<pFB> &leader_fps ,
+                         const vector<vector<int> > &leader_buckets ,
+                         const vector<pFB> &batch_fps , double threshold ,
+                         unsigned int i , vector<int> &best_leaders ,
+                         vector<double> &best_dists ) {
+
+  nearest_leader( leader_fps , leader_buckets , 0 , leader_fps.size() ,
+                  *batch_fps[i] , threshold , best_leaders[i] , best_dists[i] );
+
+}
+
+// *******************************************************************************
+// the clusters, biggest first then in order of leader, with the members in
+// ascending order of distance from the leader, which is at the front.
+void leader_clusters_to_clusters( vector<vector<pair<float,int> > > &members ,
+                                  vector<vector<int> > &clusters ,
+                                  vector<int> &clus_orig_nn_sizes ) {
+
+  vector<pair<int,int> > clus_order;
+  for( int i = 0 , is = members.size() ; i < is ; ++i ) {
+    clus_order.push_back( make_pair( -int( members[i].size() ) , i ) );
+  }
+  sort( clus_order.begin() , clus_order.end() );
+
+  clusters.reserve( members.size() );
+  clus_orig_nn_sizes.reserve( members.size() );
+  for( int i = 0 , is = clus_order.size() ; i < is ; ++i ) {
+    vector<pair<float,int> > &mems = members[clus_order[i].second];
+    sort( mems.begin() + 1 , mems.end() );
+    clusters.push_back( vector<int>() );
+    clusters.back().reserve( mems.size() );
+    for( int j = 0 , js = mems.size() ; j < js ; ++j ) {
+      clusters.back().push_back( mems[j].second );
+    }
+    clus_orig_nn_sizes.push_back( mems.size() );
+    vector<pair<float,int> >().swap( mems );
   }
 
-  if( num_fps ) {
-    send_cwd_to_slaves( world_size );
-    // send_search_details also fires off the jobs on the slaves
-    unsigned int chunk_size;
-    send_search_details( cs , num_fps , world_size , chunk_size );
-    if( cs.warm_feeling() ) {
-      cout << "NN list requirements all sent. Each slave will produce "
-           << chunk_size << " NN lists." << endl;
+}
+
+// *******************************************************************************
+void leader_cluster( ClusterSettings &cs , double threshold ,
+                     const vector<string> &subset_names ) {
+
+  gzFile gzfp;
+  bool byteswapping;
+  open_fp_file( cs.input_file() , cs.input_format() , byteswapping , gzfp );
+
+  vector<pFB> leader_fps;
+  vector<vector<int> > leader_buckets;
+  vector<vector<pair<float,int> > > members; // of each leader's cluster
+  vector<string> fp_names;
+
+  while( 1 ) {
+    vector<FingerprintBase *> raw_fps;
+    read_fps_from_file( gzfp , byteswapping , cs.input_format() ,
+                        cs.bitstring_separator() , 0 , LEADER_BATCH_SIZE ,
+                        raw_fps );
+    if( raw_fps.empty() ) {
+      break;
     }
-    // whilst the slaves are making the nnlists, there's time to re-read
-    // the file and get the fingerprint names out
-    vector<string> fp_names;
-    get_fp_names( cs.input_file() , cs.input_format() ,
-                  cs.bitstring_separator() , fp_names );
-    check_for_spaces_in_fp_names( cs.fix_spaces_in_names() , fp_names );
-
-    // wait for all slaves to announce they're done. This is because we don't
-    // want the master sending messages to a slave until it's finished the
-    // nnlists, because that interferes with messages if the master dies
-    // and we want the slave to get those so it stops early if necessary.
-    int num_finished = 0;
-    int num_slaves = world_size - 1; // process 0 is the master
-    while( num_finished < num_slaves ) {
-      MPI_Status status;
-      MPI_Probe( MPI_ANY_SOURCE , 0 , MPI_COMM_WORLD , &status );
-
-      string msg;
-      DACLIB::mpi_rec_string( status.MPI_SOURCE , msg );
-      if( cs.warm_feeling() ) {
-        cout << "Slave " << status.MPI_SOURCE << " has finished nnlists." << endl;
+    vector<pFB> batch_fps;
+    batch_fps.reserve( raw_fps.size() );
+    for( int i = 0 , is = raw_fps.size() ; i < is ; ++i ) {
+      batch_fps.push_back( pFB( raw_fps[i] ) );
+    }
+    if( !subset_names.empty() ) {
+      apply_subset_names( subset_names , batch_fps );
+    }
+    if( SAMPLES_FORMAT == cs.output_format() ) {
+      check_for_spaces_in_fp_names( cs.fix_spaces_in_names() , batch_fps );
+    }
+
+    vector<int> best_leaders( batch_fps.size() , -1 );
+    vector<double> best_dists( batch_fps.size() , 1.0 );
+    unsigned int num_old_leaders = leader_fps.size();
+    DACLIB::parallel_loop( batch_fps.size() , cs.num_threads() ,
+                           boost::bind( &nearest_old_leader ,
+                                        boost::cref( leader_fps ) ,
+                                        boost::cref( leader_buckets ) ,
+                                        boost::cref( batch_fps ) , threshold ,
+                                        _1 , boost::ref( best_leaders ) ,
+                                        boost::ref( best_dists ) ) );
+
+    for( int i = 0 , is = batch_fps.size() ; i < is ; ++i ) {
+      int fp_num = fp_names.size();
+      fp_names.push_back( batch_fps[i]->get_name() );
+      nearest_leader( leader_fps , leader_buckets , num_old_leaders ,
+                      leader_fps.size() , *batch_fps[i] , threshold ,
+                      best_leaders[i] , best_dists[i] );
+      if( -1 == best_leaders[i] ) {
+        int num_bits = batch_fps[i]->count_bits();
+        if( num_bits >= int( leader_buckets.size() ) ) {
+          leader_buckets.resize( num_bits + 1 );
+        }
+        leader_buckets[num_bits].push_back( leader_fps.size() );
+        leader_fps.push_back( batch_fps[i] );
+        members.push_back( vector<pair<float,int> >( 1 , make_pair( 0.0F , fp_num ) ) );
+      } else {
+        members[best_leaders[i]].push_back( make_pair( float( best_dists[i] ) , fp_num ) );
       }
-      ++num_finished;
     }
 
-    int num_written = 0 , tot = 0;
-    while( 1 ) {
+    if( cs.warm_feeling() ) {
+      cout << "Read " << fp_names.size() << " fingerprints, making "
+           << leader_fps.size() << " leaders so far." << endl;
+    }
+  }
+  close_fp_file_for_reading( gzfp );
+  vector<pFB>().swap( leader_fps );
 
-      vector<int> cluster;
-      int orig_nn_size = 0;
-      receive_best_clusters_from_slaves( world_size , cluster , orig_nn_size );
-      if( cluster.empty() ) {
-        break;
-      }
-      write_cluster( cs.output_format() , num_written + 1 , fp_names , cluster ,
-                     orig_nn_size , output_stream , seed_names ,
-                     singleton_names );
-      ++num_written;
-      tot += cluster.size();
-      if( cs.warm_feeling() && !( num_written % 100 ) ) {
-        cout << "Written " << num_written << " clusters, average size "
-             << tot / num_written << "." << endl;
-      }
+  vector<vector<int> > clusters;
+  vector<int> clus_orig_nn_sizes;
+  leader_clusters_to_clusters( members , clusters , clus_orig_nn_sizes );
+  report_clusters( fp_names.size() , clusters.size() );
+  write_clusters( cs , cs.output_file( threshold ) , fp_names , clusters ,
+                  clus_orig_nn_sizes );
 
-      tell_slaves_to_cross_off_cluster( world_size , cluster );
+}
 
+// *******************************************************************************
+// a separate pass through the fingerprint file for each threshold
+void leader_run( ClusterSettings &cs ) {
+
+  check_output_files( cs );
+
+  vector<string> subset_names;
+  if( !cs.subset_file().empty() ) {
+    read_subset_file( cs.subset_file() , subset_names );
+  }
+
+  const vector<double> &thresholds = cs.thresholds();
+  for( unsigned int i = 0 ; i < thresholds.size() ; ++i ) {
+    if( cs.warm_feeling() && thresholds.size() > 1 ) {
+      cout << "Clustering at threshold " << thresholds[i] << " into "
+           << cs.output_file( thresholds[i] ) << endl;
     }
+    leader_cluster( cs , thresholds[i] , subset_names );
+  }
 
-    for( int i = 1 ; i < world_size ; ++i ) {
-      DACLIB::mpi_send_string( string( "Finished" ) , i );
+}
+
+// *******************************************************************************
+// Parallel cluster formation is done in rounds.  In each round, every slave
+// sends the master its best EXTRACTION_BATCH_SIZE neighbour lists, best
+// first, and the master takes them in order for as long as the serial
+// algorithm would have chosen them in the same order. The clusters taken
+// are broadcast back to the slaves to be crossed off, and an empty round
+// means we're done.
+static const unsigned int EXTRACTION_BATCH_SIZE = 100;
+
+// *******************************************************************************
+// The order find_next_seed chooses neighbour lists in: biggest first, then
+// biggest original size, then highest seed number.
+bool better_cluster( unsigned int size_a , unsigned int orig_size_a , int seed_a ,
+                     unsigned int size_b , unsigned int orig_size_b , int seed_b ) {
+
+  if( size_a != size_b ) {
+    return size_a > size_b;
+  }
+  if( orig_size_a != orig_size_b ) {
+    return orig_size_a > orig_size_b;
+  }
+  return seed_a > seed_b;
+
+}
+
+// *******************************************************************************
+class BetterNNList {
+public :
+  BetterNNList( const vector<vector<int> > &nns , const vector<int> &orig_nn_sizes ) :
+    nns_( nns ) , orig_nn_sizes_( orig_nn_sizes ) {}
+  bool operator()( int a , int b ) const {
+    return better_cluster( nns_[a].size() , orig_nn_sizes_[nns_[a].front()] , nns_[a].front() ,
+                           nns_[b].size() , orig_nn_sizes_[nns_[b].front()] , nns_[b].front() );
+  }
+private :
+  const vector<vector<int> > &nns_;
+  const vector<int> &orig_nn_sizes_;
+};
+
+// *******************************************************************************
+// a cluster offered by a slave, with members pointing into the buffer it
+// came in
+struct ClusterCandidate {
+  unsigned int size_;
+  unsigned int orig_nn_size_;
+  const int *members_;
+  bool operator<( const ClusterCandidate &rhs ) const {
+    return better_cluster( size_ , orig_nn_size_ , members_[0] ,
+                           rhs.size_ , rhs.orig_nn_size_ , rhs.members_[0] );
+  }
+};
+
+// *******************************************************************************
+// Sends the number of lists, whether there are more lists than that, and
+// for each the size, the original size and the members, seed first.
+void send_best_nnlists_to_master( const vector<vector<int> > &nns ,
+                                  const vector<int> &orig_nn_sizes ) {
+
+  unsigned int num_to_send = min( EXTRACTION_BATCH_SIZE ,
+                                  static_cast<unsigned int>( nns.size() ) );
+  vector<int> order( nns.size() );
+  for( int i = 0 , is = nns.size() ; i < is ; ++i ) {
+    order[i] = i;
+  }
+  partial_sort( order.begin() , order.begin() + num_to_send , order.end() ,
+                BetterNNList( nns , orig_nn_sizes ) );
+
+  vector<int> msg;
+  msg.push_back( num_to_send );
+  msg.push_back( int( nns.size() > num_to_send ) );
+  for( unsigned int i = 0 ; i < num_to_send ; ++i ) {
+    const vector<int> &nn = nns[order[i]];
+    msg.push_back( nn.size() );
+    msg.push_back( orig_nn_sizes[nn.front()] );
+    msg.insert( msg.end() , nn.begin() , nn.end() );
+  }
+
+  int msg_size = msg.size();
+  MPI_Gather( &msg_size , 1 , MPI_INT , 0 , 1 , MPI_INT , 0 , MPI_COMM_WORLD );
+  MPI_Gatherv( &msg[0] , msg_size , MPI_INT , 0 , 0 , 0 , MPI_INT , 0 ,
+               MPI_COMM_WORLD );
+
+}
+
+// *******************************************************************************
+// Gets the best lists from each slave and picks the next clusters from
+// them.  A candidate is taken if it is better than every list a slave
+// hasn't sent, and doesn't share any members with the clusters already
+// taken this round.  Removing the earlier clusters then leaves it
+// unchanged and the best of what's left, so it's the one the serial
+// algorithm would choose next. The first candidate that fails ends the
+// round, because after that the order can change.
+void receive_best_nnlists_from_slaves( int world_size , unsigned int num_fps ,
+                                       vector<vector<int> > &clusters ,
+                                       vector<int> &clus_orig_nn_sizes ) {
+
+  int zero = 0;
+  vector<int> msg_sizes( world_size , 0 );
+  MPI_Gather( &zero , 1 , MPI_INT , &msg_sizes[0] , 1 , MPI_INT , 0 , MPI_COMM_WORLD );
+  vector<int> displs( world_size , 0 );
+  for( int i = 1 ; i < world_size ; ++i ) {
+    displs[i] = displs[i - 1] + msg_sizes[i - 1];
+  }
+  vector<int> msgs( displs.back() + msg_sizes.back() + 1 );
+  MPI_Gatherv( &zero , 0 , MPI_INT , &msgs[0] , &msg_sizes[0] , &displs[0] ,
+               MPI_INT , 0 , MPI_COMM_WORLD );
+
+  vector<ClusterCandidate> cands;
+  // the last candidate sent by each slave that has more lists is as good
+  // as any of its lists that weren't sent. Any candidate taken must be at
+  // least as good as the best of these.
+  ClusterCandidate bound;
+  bool have_bound = false;
+  for( int i = 1 ; i < world_size ; ++i ) {
+    const int *msg = &msgs[displs[i]];
+    int num_sent = msg[0];
+    bool more_lists = msg[1];
+    msg += 2;
+    for( int j = 0 ; j < num_sent ; ++j ) {
+      ClusterCandidate cand;
+      cand.size_ = msg[0];
+      cand.orig_nn_size_ = msg[1];
+      cand.members_ = msg + 2;
+      msg += 2 + cand.size_;
+      cands.push_back( cand );
     }
+    if( more_lists && num_sent ) {
+      if( !have_bound || cands.back() < bound ) {
+        bound = cands.back();
+        have_bound = true;
+      }
+    }
+  }
+  sort( cands.begin() , cands.end() );
 
-    string fp_out = " fingerprint";
-    if( tot > 1 ) {
-      fp_out += "s";
+  static vector<char> in_batch;
+  if( in_batch.size() != num_fps ) {
+    in_batch = vector<char>( num_fps , 0 );
+  }
+  for( int i = 0 , is = cands.size() ; i < is ; ++i ) {
+    if( have_bound && bound < cands[i] ) {
+      break;
+    }
+    const int *members = cands[i].members_;
+    bool clash = false;
+    for( unsigned int j = 0 ; j < cands[i].size_ ; ++j ) {
+      if( in_batch[members[j]] ) {
+        clash = true;
+        break;
+      }
+    }
+    if( clash ) {
+      break;
     }
-    string clus_out = " cluster";
-    if( num_written > 1 ) {
-      clus_out += "s";
+    for( unsigned int j = 0 ; j < cands[i].size_ ; ++j ) {
+      in_batch[members[j]] = 1;
+    }
+    clusters.push_back( vector<int>( members , members + cands[i].size_ ) );
+    clus_orig_nn_sizes.push_back( cands[i].orig_nn_size_ );
+  }
+
+  // reset in_batch for next time round
+  for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
+    for( int j = 0 , js = clusters[i].size() ; j < js ; ++j ) {
+      in_batch[clusters[i][j]] = 0;
     }
-    cout << "Clustered " << tot << fp_out << " into "
-         << num_written << clus_out << "." << endl;
   }
 
 }
 
-// ********************************************************************
-void receive_new_cwd() {
+// *******************************************************************************
+// master sends the clusters, slaves receive them, as the number of clusters
+// then each cluster's size and members.  Slaves get all the members in one
+// go, and false if there weren't any clusters.
+void broadcast_clusters( const vector<vector<int> > &clusters ) {
 
-  string new_cwd;
-  DACLIB::mpi_rec_string( 0 , new_cwd );
-  if(chdir( new_cwd.c_str() ) < 0){
-    cerr << "ERROR : couldn't change to directory " << new_cwd << endl;
-    exit(1);
+  vector<int> msg;
+  msg.push_back( clusters.size() );
+  for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
+    msg.push_back( clusters[i].size() );
+    msg.insert( msg.end() , clusters[i].begin() , clusters[i].end() );
   }
+  int msg_size = msg.size();
+  MPI_Bcast( &msg_size , 1 , MPI_INT , 0 , MPI_COMM_WORLD );
+  MPI_Bcast( &msg[0] , msg_size , MPI_INT , 0 , MPI_COMM_WORLD );
 
 }
 
 // *******************************************************************************
-void slave_event_loop() {
+bool receive_broadcast_clusters( vector<int> &cluster_members ) {
 
-  string msg;
+  int msg_size = 0;
+  MPI_Bcast( &msg_size , 1 , MPI_INT , 0 , MPI_COMM_WORLD );
+  vector<int> msg( msg_size );
+  MPI_Bcast( &msg[0] , msg_size , MPI_INT , 0 , MPI_COMM_WORLD );
 
-  ClusterSettings cs;
-  unsigned int num_fps_to_do , start_fp;
-  vector<vector<int> > nns;
-  vector<int> orig_nn_sizes;
-  vector<string> fp_names;
+  cluster_members.clear();
+  for( int i = 0 , j = 1 ; i < msg[0] ; ++i ) {
+    int clus_size = msg[j++];
+    cluster_members.insert( cluster_members.end() , msg.begin() + j ,
+                            msg.begin() + j + clus_size );
+    j += clus_size;
+  }
 
-#ifdef NOTYET
-  int wr;
-  MPI_Comm_rank( MPI_COMM_WORLD , &wr );
-  cout << "Slave event loop for : " << wr << endl;
-#endif
+  return msg[0] > 0;
 
-  while( 1 ) {
+}
 
-    DACLIB::mpi_rec_string( 0 , msg );
-#if DEBUG == 1
-    cout << world_rank << " : received message : " << msg << endl;
-#endif
-    if( string( "Finished" ) == msg ) {
+// *******************************************************************************
+// the slave's side of parallel_make_clusters
+void make_clusters_with_master( unsigned int num_fps , vector<vector<int> > &nns ,
+                                const vector<int> &orig_nn_sizes ) {
+
+  while( 1 ) {
+    send_best_nnlists_to_master( nns , orig_nn_sizes );
+    vector<int> cluster_members;
+    if( !receive_broadcast_clusters( cluster_members ) ) {
       break;
-    } else if( string( "Search_Details" ) == msg ) {
-      receive_search_details( cs , num_fps_to_do , start_fp );
-      make_nnlists( cs , start_fp , num_fps_to_do , fp_names , nns );
-      // orig_nn_sizes needs to be indexed for the original fp set.
-      make_orig_nn_sizes( fp_names.size() , start_fp , num_fps_to_do ,
-                          nns , orig_nn_sizes );
-      tell_master_slave_has_done_nnlists();
-    } else if( string( "Send_Best_Cluster" ) == msg ) {
-      send_best_cluster_to_master( nns , orig_nn_sizes );
-    } else if( string( "Send_Best_Cluster_Details" ) == msg ) {
-      send_best_cluster_details_to_master( nns , orig_nn_sizes );
-    } else if( string( "Send_Cluster" ) == msg ) {
-      // reads the cluster number off the pvm buffer, sends that cluster to
-      // the master
-      send_cluster_to_master( nns );
-    } else if( string( "Cross_Off_Cluster" ) == msg ) {
-      cross_off_cluster( fp_names.size() , nns );
-    } else if( string( "New_CWD" ) == msg ) {
-      receive_new_cwd();
+    }
+    remove_cluster_from_nns( num_fps , cluster_members , nns );
+  }
+
+}
+
+// *******************************************************************************
+// The neighbour lists are made in chunks handed out by the master as the
+// slaves ask for them, so a slave that gets cheap chunks does more of them.
+// Aiming for about this many chunks per slave.
+static const unsigned int NNLIST_CHUNKS_PER_SLAVE = 20;
+
+// *******************************************************************************
+void send_search_details( ClusterSettings &cs , int world_size ) {
+
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Search_Details" ) , i );
+    cs.send_contents_via_mpi( i );
+  }
+
+}
+
+// *******************************************************************************
+void receive_search_details( ClusterSettings &cs ) {
+
+  cs.receive_contents_via_mpi();
+
+}
+
+// *******************************************************************************
+// Each slave asks for a chunk of neighbour lists to do, as the first fp and
+// the number of them, and keeps asking until it gets an empty one.
+void hand_out_nnlist_chunks( ClusterSettings &cs , unsigned int num_fps ,
+                             int world_size ) {
+
+  int num_slaves = world_size - 1; // process 0 is the master
+  unsigned int chunk_size = num_fps / ( num_slaves * NNLIST_CHUNKS_PER_SLAVE );
+  if( !chunk_size ) {
+    chunk_size = 1;
+  }
+  if( cs.warm_feeling() ) {
+    cout << "Handing out neighbour lists in chunks of " << chunk_size << "." << endl;
+  }
+
+  unsigned int next_fp = 0;
+  int num_finished = 0;
+  vector<int> num_chunks( world_size , 0 );
+  while( num_finished < num_slaves ) {
+    MPI_Status status;
+    int ready;
+    MPI_Recv( &ready , 1 , MPI_INT , MPI_ANY_SOURCE , 0 , MPI_COMM_WORLD , &status );
+    unsigned int chunk[2];
+    chunk[0] = next_fp;
+    chunk[1] = min( chunk_size , num_fps - next_fp );
+    next_fp += chunk[1];
+    MPI_Send( chunk , 2 , MPI_UNSIGNED , status.MPI_SOURCE , 0 , MPI_COMM_WORLD );
+    if( chunk[1] ) {
+      ++num_chunks[status.MPI_SOURCE];
     } else {
-      int world_rank;
-      MPI_Comm_rank( MPI_COMM_WORLD , &world_rank );
-      cout << world_rank << " received suspect message " << msg << endl;
+      ++num_finished;
+      if( cs.warm_feeling() ) {
+        cout << "Slave " << status.MPI_SOURCE << " has finished nnlists, having done "
+             << num_chunks[status.MPI_SOURCE] << " chunks." << endl;
+      }
     }
+  }
+
+}
+
+// *******************************************************************************
+// the slave's side of hand_out_nnlist_chunks. The neighbour lists are
+// added to nns in the order the chunks come, so aren't necessarily in fp
+// order, but each has its fp at the front.
+void make_nnlists_for_master( ClusterSettings &cs , const vector<pFB> &fps ,
+                              vector<NNList> &nns ) {
 
+  while( 1 ) {
+    int ready = 1;
+    MPI_Send( &ready , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD );
+    unsigned int chunk[2];
+    MPI_Recv( chunk , 2 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+    if( !chunk[1] ) {
+      break;
+    }
+    make_nnlists( cs.warm_feeling() , cs.thresholds() , chunk[0] ,
+                  chunk[0] + chunk[1] , cs.num_threads() , fps , nns );
   }
 
 }
 
 // *******************************************************************************
-void read_next_samples_cluster( istream &is ,
-                                vector<string> &cluster , int &orig_nn_size ) {
+// The master reads the fingerprints once and broadcasts them to the slaves,
+// rather than each slave reading the file for itself. MPI counts are ints,
+// so a big block goes in pieces.  Called by master and slaves alike.
+void broadcast_fp_block( vector<char> &fp_block ) {
 
-  string next_line;
-  getline( is , next_line );
-  if( is.eof() ) {
-    return;
+  static const unsigned long long BCAST_PIECE = 1 << 26;
+
+  unsigned long long block_size = fp_block.size();
+  MPI_Bcast( &block_size , 1 , MPI_UNSIGNED_LONG_LONG , 0 , MPI_COMM_WORLD );
+  fp_block.resize( block_size );
+  for( unsigned long long i = 0 ; i < block_size ; i += BCAST_PIECE ) {
+    int piece = min( BCAST_PIECE , block_size - i );
+    MPI_Bcast( &fp_block[i] , piece , MPI_CHAR , 0 , MPI_COMM_WORLD );
   }
-  istringstream iss( next_line );
-  string tmp , nns;
-  iss >> tmp >> tmp >> nns >> tmp;
-  cluster = ( vector<string>( istream_iterator<string>( iss ) ,
-                               istream_iterator<string>() ) );
-  vector<string> splits;
-  boost::algorithm::split( splits , nns , boost::algorithm::is_any_of( "()" ) );
-  if( splits.size() > 1 ) {
-    orig_nn_size = lexical_cast<int>( splits[1] );
-  } else {
-    orig_nn_size = -1; // but there's a problem.
+
+}
+
+// *******************************************************************************
+void broadcast_fps( const vector<pFB> &fps ) {
+
+  vector<FingerprintBase *> raw_fps;
+  raw_fps.reserve( fps.size() );
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    raw_fps.push_back( fps[i].get() );
   }
+  vector<char> fp_block;
+  pack_fps( raw_fps , fp_block );
+  broadcast_fp_block( fp_block );
 
 }
 
 // *******************************************************************************
-void read_next_csv_cluster( istream &is ,
-                            vector<string> &cluster , int &orig_nn_size ) {
+void receive_broadcast_fps( ClusterSettings &cs , vector<pFB> &fps ) {
 
-  string next_line;
-  getline( is , next_line );
-  if( is.eof() ) {
-    return;
+  vector<FingerprintBase *> raw_fps;
+  {
+    vector<char> fp_block;
+    broadcast_fp_block( fp_block );
+    unpack_fps( cs.input_format() , fp_block , raw_fps );
   }
-  vector<string> splits;
-  boost::algorithm::split( splits , next_line , boost::algorithm::is_any_of( "," ) );
-  if( splits.size() < 5 ) {
-    return;
+  fps.reserve( raw_fps.size() );
+  for( int i = 0 , is = raw_fps.size() ; i < is ; ++i ) {
+    fps.push_back( pFB( raw_fps[i] ) );
   }
-  cluster.push_back( splits[3] );
-  orig_nn_size = lexical_cast<int>( splits[4] );
-  unsigned int clus_size = boost::lexical_cast<int>( splits[1] );
-  // we've already read the first line, so read clus_size - 1 more.
-  for( unsigned int i = 0 ; i < clus_size - 1 ; ++i ) {
-    getline( is , next_line );
-    if( is.eof() ) {
-      return;
-    }
-    vector<string> splits1;
-    boost::algorithm::split( splits1 , next_line , boost::algorithm::is_any_of( "," ) );
-    if( splits1.size() < 5 ) {
-      return;
+
+}
+
+// ********************************************************************
+void send_cwd_to_slaves( int world_size ) {
+
+  string cwd = DACLIB::get_cwd();
+  if( cwd.length() ) {
+    // process 0 is the master
+    for( int i = 1 ; i < world_size ; ++i ) {
+      DACLIB::mpi_send_string( string( "New_CWD" ) , i );
+      DACLIB::mpi_send_string( cwd , i );
     }
-    cluster.push_back( splits1[3] );
   }
 
 }
 
 // *******************************************************************************
-void read_next_cluster( istream &is , ClusterSettings &cs ,
-                        vector<string> &cluster , int &orig_nn_size ) {
+// send the neighbour lists, with distances, so the master can write them to
+// file. They go as one block, of the number of lists, the size of each, all
+// the neighbour numbers and then all the distances, as floats.
+void send_nnlists_to_master( const vector<NNList> &nn_dists ) {
+
+  unsigned int num_lists = nn_dists.size();
+  size_t num_nbs = 0;
+  for( unsigned int i = 0 ; i < num_lists ; ++i ) {
+    num_nbs += nn_dists[i].size();
+  }
+  vector<char> block( sizeof( unsigned int ) + num_lists * sizeof( int ) +
+                      num_nbs * ( sizeof( int ) + sizeof( float ) ) );
+  char *sizes = &block[0] + sizeof( unsigned int );
+  char *nb_nums = sizes + num_lists * sizeof( int );
+  char *nb_dists = nb_nums + num_nbs * sizeof( int );
+  memcpy( &block[0] , &num_lists , sizeof( unsigned int ) );
+  for( unsigned int i = 0 ; i < num_lists ; ++i ) {
+    int nn_size = nn_dists[i].size();
+    memcpy( sizes , &nn_size , sizeof( int ) );
+    sizes += sizeof( int );
+    for( int j = 0 ; j < nn_size ; ++j ) {
+      memcpy( nb_nums , &nn_dists[i][j].first , sizeof( int ) );
+      nb_nums += sizeof( int );
+      memcpy( nb_dists , &nn_dists[i][j].second , sizeof( float ) );
+      nb_dists += sizeof( float );
+    }
+  }
 
-  static bool first_call( true );
-  if( SAMPLES_FORMAT == cs.output_format() ) {
-    if( first_call ) {
-      // 1st line is headings
-      string next_line;
-      getline( is , next_line );
-      first_call = false;
+  DACLIB::send_block( block , 0 );
+
+}
+
+// *******************************************************************************
+// the other end of send_nnlists_to_master, adding the slave's lists to the
+// end of nn_dists
+void receive_nnlists_from_slave( int slave , vector<NNList> &nn_dists ) {
+
+  vector<char> block;
+  DACLIB::receive_block( slave , block );
+
+  unsigned int num_lists = 0;
+  memcpy( &num_lists , &block[0] , sizeof( unsigned int ) );
+  size_t num_nbs = ( block.size() - sizeof( unsigned int ) - num_lists * sizeof( int ) ) /
+      ( sizeof( int ) + sizeof( float ) );
+  const char *sizes = &block[0] + sizeof( unsigned int );
+  const char *nb_nums = sizes + num_lists * sizeof( int );
+  const char *nb_dists = nb_nums + num_nbs * sizeof( int );
+  nn_dists.reserve( nn_dists.size() + num_lists );
+  for( unsigned int i = 0 ; i < num_lists ; ++i ) {
+    int nn_size = 0;
+    memcpy( &nn_size , sizes , sizeof( int ) );
+    sizes += sizeof( int );
+    nn_dists.push_back( NNList( nn_size ) );
+    NNList &nbs = nn_dists.back();
+    for( int j = 0 ; j < nn_size ; ++j ) {
+      memcpy( &nbs[j].first , nb_nums , sizeof( int ) );
+      nb_nums += sizeof( int );
+      memcpy( &nbs[j].second , nb_dists , sizeof( float ) );
+      nb_dists += sizeof( float );
     }
-    read_next_samples_cluster( is , cluster , orig_nn_size );
-  } else if( CSV_FORMAT == cs.output_format() ) {
-    read_next_csv_cluster( is , cluster , orig_nn_size );
   }
 
 }
 
 // *******************************************************************************
-void write_cluster( ostream &os , OUTPUT_FORMAT output_format ,
-                    const vector<string> &cluster ,
-                    int orig_nn_size , int clus_num ) {
+void tell_slaves_finished( int world_size ) {
+
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Finished" ) , i );
+  }
+
+}
+
+// *******************************************************************************
+// get the neighbour lists from the slaves in turn and write them straight to
+// file, so the master only holds one slave's lists at a time. If the file can't
+// be written, the slaves are told to finish and the run stops, as it does
+// in serial. Once the slaves have started sending, the rest of their lists
+// are still received so none of them is left stuck in a send.
+void receive_nnlists_from_slaves( ClusterSettings &cs , int world_size ,
+                                  const vector<string> &fp_names ) {
 
-  if( SAMPLES_FORMAT == output_format ) {
-    os << cluster.front() << " : " << cluster.size() << "("
-       << orig_nn_size << ") : ";
-    for( int i = 0 , is = cluster.size() ; i < is ; ++i ) {
-      os << cluster[i] << "  ";
+  gzFile gzfp;
+  try {
+    open_nnlists_file_for_writing( cs.write_nnlists_file() , cs.threshold() ,
+                                   fp_names , gzfp );
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    tell_slaves_finished( world_size );
+    MPI_Finalize();
+    exit( 1 );
+  } catch( NNListsFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    tell_slaves_finished( world_size );
+    MPI_Finalize();
+    exit( 1 );
+  }
+
+  string write_error;
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Send_NNLists" ) , i );
+    vector<NNList> slave_nn_dists;
+    receive_nnlists_from_slave( i , slave_nn_dists );
+    for( int j = 0 , js = slave_nn_dists.size() ; j < js && write_error.empty() ; ++j ) {
+      try {
+        write_nnlist_with_seed( cs.write_nnlists_file() , gzfp , slave_nn_dists[j] );
+      } catch( NNListsFileError &e ) {
+        write_error = e.what();
+      }
     }
-    os << endl;
-  } else if( CSV_FORMAT == output_format ) {
-    for( int j = 0 , js = cluster.size() ; j < js ; ++j ) {
-      os << clus_num << "," << cluster.size() << "," << cluster.front()
-         << "," << cluster[j] << "," << orig_nn_size << endl;
+  }
+  if( write_error.empty() ) {
+    try {
+      close_nnlists_file( cs.write_nnlists_file() , gzfp );
+    } catch( NNListsFileError &e ) {
+      write_error = e.what();
     }
+  } else {
+    gzclose( gzfp );
+  }
+  if( !write_error.empty() ) {
+    cerr << write_error << endl;
+    cout << write_error << endl;
+    tell_slaves_finished( world_size );
+    MPI_Finalize();
+    exit( 1 );
+  }
+
+  if( cs.warm_feeling() ) {
+    cout << "Written neighbour lists to " << cs.write_nnlists_file() << endl;
   }
 
 }
 
 // *******************************************************************************
-void update_clusters_file( ClusterSettings &cs ,
-                          const vector<vector<pair<int,float> > > &seed_nbs ,
-                          const map<string,int> &seed_fps_map ,
-                          const vector<pFB> &seed_fps ,
-                          const vector<pFB> &singleton_fps ) {
+// all the neighbour lists, for Jarvis-Patrick clustering on the master
+void gather_nnlists_from_slaves( int world_size , vector<NNList> &nn_dists ) {
 
-  ifstream ifs( cs.output_file().c_str() );
-  filesystem::path temp = boost::filesystem::unique_path();
-  const string tmp_clus_file = temp.native();  // optional
-  ofstream ofs( tmp_clus_file.c_str() );
-  if( SAMPLES_FORMAT == cs.output_format() ) {
-    ofs << "Molecule name : Cluster size : Cluster Members" << endl;
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Send_NNLists" ) , i );
+    receive_nnlists_from_slave( i , nn_dists );
+  }
+
+}
+
+// *******************************************************************************
+// do the clustering using the neighbour lists on the slaves
+void parallel_make_clusters( ClusterSettings &cs , int world_size ,
+                             unsigned int num_fps ,
+                             vector<vector<int> > &clusters ,
+                             vector<int> &clus_orig_nn_sizes ) {
+
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Make_Clusters" ) , i );
   }
 
-  int orig_nn_size , clus_num = 1;
+  int tot = 0 , num_rounds = 0;
   while( 1 ) {
-    vector<string> cluster;
-    read_next_cluster( ifs , cs , cluster , orig_nn_size );
-    if( cluster.empty() ) {
+
+    vector<vector<int> > new_clusters;
+    vector<int> new_orig_nn_sizes;
+    receive_best_nnlists_from_slaves( world_size , num_fps , new_clusters ,
+                                      new_orig_nn_sizes );
+    broadcast_clusters( new_clusters );
+    if( new_clusters.empty() ) {
       break;
     }
-#ifdef NOTYET
-    cout << "Next cluster : ";
-    copy( cluster.begin() , cluster.end() , stringOut );
-    cout << " : " << orig_nn_size << endl;
-#endif
-    map<string,int>::const_iterator p = seed_fps_map.find( cluster.front() );
-    // if seed_fps[p->second] is empty, this is a singleton that's been put
-    // in a different cluster, so don't write it
-    if( p == seed_fps_map.end() ) {
-      cout << "ERROR : failed to find seed " << cluster.front()
-           << " in seeds map." << endl;
-      cout << "seeds size : " << seed_fps_map.size() << endl;
-      map<string,int>::const_iterator pp , pps;
-      for( pp = seed_fps_map.begin() , pps = seed_fps_map.end() ; pp != pps ; ++pp ) {
-        cout << pp->first << endl;
-      }
-      exit( 1 );
-    }
-    if( seed_fps[p->second] ) {
-      if( p != seed_fps_map.end() && !seed_nbs[p->second].empty() ) {
-        for( int i = 0 , is = seed_nbs[p->second].size() ; i < is ; ++i ) {
-          cluster.push_back( singleton_fps[seed_nbs[p->second][i].first]->get_name() );
-        }
+    ++num_rounds;
+
+    for( int i = 0 , is = new_clusters.size() ; i < is ; ++i ) {
+      clusters.push_back( vector<int>() );
+      clusters.back().swap( new_clusters[i] );
+      clus_orig_nn_sizes.push_back( new_orig_nn_sizes[i] );
+      tot += clusters.back().size();
+      if( cs.warm_feeling() && !( clusters.size() % 100 ) ) {
+        cout << "Made " << clusters.size() << " clusters, average size "
+             << tot / clusters.size() << "." << endl;
       }
-      write_cluster( ofs , cs.output_format() , cluster , orig_nn_size ,
-                     clus_num );
-      ++clus_num;
     }
+
   }
 
-  ifs.close();
-  filesystem::remove( filesystem::path( cs.output_file() ) );
-  try {
-    filesystem::rename( temp , filesystem::path( cs.output_file() ) );
-  } catch( filesystem::filesystem_error &e ) {
-    filesystem::copy_file( temp , filesystem::path( cs.output_file() ) );
-    filesystem::remove( filesystem::path( temp ) );
+  if( cs.warm_feeling() ) {
+    cout << "Made " << clusters.size() << " clusters in " << num_rounds
+         << " rounds." << endl;
   }
+  report_clusters( tot , clusters.size() );
 
 }
 
 // *******************************************************************************
-void collapse_singletons( ClusterSettings &cs ,
-                          vector<string> &seed_names ,
-                          vector<string> &singleton_names ) {
+// tell the slaves to make their neighbour lists at the given threshold from
+// the ones they made at the largest threshold.
+void tell_slaves_new_threshold( int world_size , double threshold ) {
 
-  if( cs.warm_feeling() ) {
-    cout << "Collapse_singletons at " << cs.singletons_threshold() << "." << endl;
-    if( 1 == singleton_names.size() ) {
-      cout << "There is 1 singleton";
-    } else {
-      cout << "There are " << singleton_names.size() << " singletons";
-    }
-    cout << " to slot into " << seed_names.size() << " cluster";
-    if( seed_names.size() > 1 ) {
-      cout << "s";
-    }
-    cout << "." << endl;
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "New_Threshold" ) , i );
+    MPI_Send( &threshold , 1 , MPI_DOUBLE , i , 0 , MPI_COMM_WORLD );
   }
 
-  sort( seed_names.begin() , seed_names.end() );
-  sort( singleton_names.begin() , singleton_names.end() );
+}
+
+// *******************************************************************************
+void parallel_run( ClusterSettings &cs , int world_size ) {
 
-  // re-read the fp file for the seeds and singletons
-  vector<pFB> seed_fps , singleton_fps;
-  read_fp_file( cs , seed_names , singleton_names , seed_fps , singleton_fps );
+  check_output_files( cs );
 
-  vector<vector<pair<int,float> > >seed_nbs( seed_names.size() );
-  map<string,int> seed_fps_map , singleton_fps_map;
-  for( int i = 0 , is = seed_fps.size() ; i < is ; ++i ) {
-    seed_fps_map.insert( make_pair( seed_fps[i]->get_name() , i ) );
-  }
-  for( int i = 0 , is = singleton_fps.size() ; i < is ; ++i ) {
-    singleton_fps_map.insert( make_pair( singleton_fps[i]->get_name() , i ) );
-  }
+  // the one read of the fingerprint file, with the subset applied. The
+  // fps are kept for collapsing singletons.
+  vector<pFB> fps;
+  read_all_fps( cs , fps );
+  unsigned int num_fps = fps.size();
 
-  for( int i = 0 , is = singleton_fps.size() ; i < is ; ++i ) {
-    if( !singleton_fps[i] ) {
-      continue; // it might have been promoted by now
+  if( num_fps ) {
+    send_cwd_to_slaves( world_size );
+    // send_search_details also fires off the jobs on the slaves, which
+    // start by receiving the fps
+    send_search_details( cs , world_size );
+    broadcast_fps( fps );
+    if( cs.warm_feeling() ) {
+      cout << "NN list requirements and fingerprints all sent." << endl;
     }
-    double nearest_dist = cs.singletons_threshold();
-    int nearest_seed = -1;
-    for( int j = 0 , js = seed_fps.size() ; j < js ; ++j ) {
-      if( !seed_fps[j] || singleton_fps[i]->get_name() == seed_fps[j]->get_name() ) {
-        continue;
+    vector<string> fp_names;
+    fps_to_name( fps , fp_names );
+    if( !collapsing_singletons( cs ) ) {
+      vector<pFB>().swap( fps );
+    }
+
+    // the slaves only want to hear from the master about the chunks
+    // until they're all finished
+    hand_out_nnlist_chunks( cs , num_fps , world_size );
+
+    const vector<double> &thresholds = cs.thresholds();
+    if( JARVIS_PATRICK == cs.algorithm() ) {
+      // the clustering is done on the master from all the neighbour lists
+      vector<NNList> nn_dists;
+      gather_nnlists_from_slaves( world_size , nn_dists );
+      if( !cs.write_nnlists_file().empty() ) {
+        write_nnlists_file( cs , cs.threshold() , fp_names , nn_dists );
       }
-      double dist = seed_fps[j]->calc_distance( *singleton_fps[i] , cs.singletons_threshold() );
-      if( dist < nearest_dist ) {
-        nearest_dist = dist;
-        nearest_seed = j;
+      for( unsigned int i = 0 ; i < thresholds.size() ; ++i ) {
+        if( cs.warm_feeling() && thresholds.size() > 1 ) {
+          cout << "Clustering at threshold " << thresholds[i] << " into "
+               << cs.output_file( thresholds[i] ) << endl;
+        }
+        vector<vector<int> > clusters;
+        vector<int> clus_orig_nn_sizes;
+        jarvis_patrick_clusters( cs , thresholds[i] , num_fps , nn_dists ,
+                                 clusters , clus_orig_nn_sizes );
+        finish_clusters( cs , thresholds[i] , fps , fp_names , clusters ,
+                         clus_orig_nn_sizes );
       }
+      tell_slaves_finished( world_size );
+      return;
     }
-    if( nearest_seed != -1 ) {
-      if( cs.warm_feeling() ) {
-        cout << "Singleton " << singleton_fps[i]->get_name() << " goes into cluster of "
-                << seed_fps[nearest_seed]->get_name() << " at distance " << nearest_dist << endl;
+
+    if( !cs.write_nnlists_file().empty() ) {
+      receive_nnlists_from_slaves( cs , world_size , fp_names );
+    }
+
+    for( unsigned int i = 0 ; i < thresholds.size() ; ++i ) {
+      if( thresholds.size() > 1 ) {
+        tell_slaves_new_threshold( world_size , thresholds[i] );
       }
-      seed_nbs[nearest_seed].push_back( make_pair( i , nearest_dist ) );
-      // remove this singleton from seeds
-      map<string,int>::const_iterator p = seed_fps_map.find( singleton_fps[i]->get_name() );
-      seed_fps[p->second].reset( static_cast<FingerprintBase *>( 0 ) );
-      // if the seed was a singleton it isn't any more, so take it out
-      p = singleton_fps_map.find( seed_fps[nearest_seed]->get_name() );
-      if( p != singleton_fps_map.end() ) {
-        singleton_fps[p->second].reset( static_cast<FingerprintBase *>( 0 ) );
+      if( cs.warm_feeling() && thresholds.size() > 1 ) {
+        cout << "Clustering at threshold " << thresholds[i] << " into "
+             << cs.output_file( thresholds[i] ) << endl;
       }
+      vector<vector<int> > clusters;
+      vector<int> clus_orig_nn_sizes;
+      parallel_make_clusters( cs , world_size , num_fps , clusters ,
+                              clus_orig_nn_sizes );
+      finish_clusters( cs , thresholds[i] , fps , fp_names , clusters ,
+                       clus_orig_nn_sizes );
     }
   }
 
+  tell_slaves_finished( world_size );
+
+}
+
+// ********************************************************************
+void receive_new_cwd() {
+
+  string new_cwd;
+  DACLIB::mpi_rec_string( 0 , new_cwd );
+  if(chdir( new_cwd.c_str() ) < 0){
+    cerr << "ERROR : couldn't change to directory " << new_cwd << endl;
+    exit(1);
+  }
+
+}
+
+// *******************************************************************************
+void slave_event_loop() {
+
+  string msg;
+
+  ClusterSettings cs;
+  vector<NNList> nn_dists;
+  vector<vector<int> > nns;
+  vector<int> orig_nn_sizes;
+  vector<string> fp_names;
+
 #ifdef NOTYET
-  for( int i = 0 , is = seed_nbs.size() ; i < is ; ++i ) {
-    sort( seed_nbs[i].begin() , seed_nbs[i].end() , SortNbsByDist() );
-    if( seed_fps[i] ) {
-      cout << seed_fps[i]->get_name() << " : ";
-      for( int j = 0 , js = seed_nbs[i].size() ; j < js ; ++j ) {
-        cout << seed_nbs[i][j].first << " ";
+  int wr;
+  MPI_Comm_rank( MPI_COMM_WORLD , &wr );
+  cout << "Slave event loop for : " << wr << endl;
+#endif
+
+  while( 1 ) {
+
+    DACLIB::mpi_rec_string( 0 , msg );
+#if DEBUG == 1
+    cout << world_rank << " : received message : " << msg << endl;
+#endif
+    if( string( "Finished" ) == msg ) {
+      break;
+    } else if( string( "Search_Details" ) == msg ) {
+      receive_search_details( cs );
+      {
+        vector<pFB> fps;
+        receive_broadcast_fps( cs , fps );
+        make_nnlists_for_master( cs , fps , nn_dists );
+        fps_to_name( fps , fp_names );
+      }
+      nnlists_at_threshold( cs.threshold() , nn_dists , nns );
+      // for Jarvis-Patrick, the master will ask for the lists to cluster
+      if( JARVIS_PATRICK != cs.algorithm() &&
+          cs.write_nnlists_file().empty() && 1 == cs.thresholds().size() ) {
+        vector<NNList>().swap( nn_dists );
       }
-      cout << endl;
+      // orig_nn_sizes needs to be indexed for the original fp set.
+      make_orig_nn_sizes( fp_names.size() , nns , orig_nn_sizes );
+    } else if( string( "Send_NNLists" ) == msg ) {
+      send_nnlists_to_master( nn_dists );
+      if( JARVIS_PATRICK == cs.algorithm() || 1 == cs.thresholds().size() ) {
+        vector<NNList>().swap( nn_dists );
+      }
+    } else if( string( "New_Threshold" ) == msg ) {
+      double new_threshold;
+      MPI_Recv( &new_threshold , 1 , MPI_DOUBLE , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+      nnlists_at_threshold( new_threshold , nn_dists , nns );
+      make_orig_nn_sizes( fp_names.size() , nns , orig_nn_sizes );
+    } else if( string( "Make_Clusters" ) == msg ) {
+      make_clusters_with_master( fp_names.size() , nns , orig_nn_sizes );
+    } else if( string( "New_CWD" ) == msg ) {
+      receive_new_cwd();
     } else {
-      cout << i << " is empty" << endl;
+      int world_rank;
+      MPI_Comm_rank( MPI_COMM_WORLD , &world_rank );
+      cout << world_rank << " received suspect message " << msg << endl;
     }
+
+  }
+
+}
+
+// *******************************************************************************
+// Work out from a sample of the fingerprints how big the run would be. Each
+// fingerprint is compared with every other one to make the neighbour lists,
+// and each list has its fingerprint at the front.  In a parallel run, every
+// process has all the fingerprints and the slaves share out the distance
+// calculations.  For Taylor-Butina, the slaves also share the lists, but for
+// Jarvis-Patrick the master gathers them all.
+static const unsigned int ESTIMATE_SAMPLE_SIZE = 2000;
+
+void estimate_run( ClusterSettings &cs , int world_size ) {
+
+  unsigned int num_fps = 0;
+  vector<FingerprintBase *> sample_fps;
+  try {
+    sample_fp_file( cs.input_file() , cs.input_format() ,
+                    cs.bitstring_separator() , ESTIMATE_SAMPLE_SIZE ,
+                    num_fps , sample_fps );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
   }
-#endif
 
-  update_clusters_file( cs , seed_nbs , seed_fps_map , seed_fps , singleton_fps );
+  double num_pairs , num_hits , secs_per_dist;
+  sample_distances( sample_fps , sample_fps , true , cs.threshold() ,
+                    num_pairs , num_hits , secs_per_dist );
+
+  double n = num_fps;
+  double num_dists = n * ( n - 1.0 );
+  double num_nbs = num_pairs > 0.0 ? num_dists * num_hits / num_pairs : 0.0;
+  double fps_bytes = n * mean_fp_bytes( sample_fps );
+  double nn_dists_bytes = n * sizeof( NNList ) + ( num_nbs + n ) * sizeof( NNList::value_type );
+  double nns_bytes = n * sizeof( vector<int> ) + ( num_nbs + n ) * sizeof( int );
+  int num_workers = world_size > 1 ? world_size - 1 : 1;
+  double cpu_secs = num_dists * secs_per_dist;
+
+  cout << "Estimate for " << num_fps << " fingerprints at threshold "
+       << cs.threshold() << ", from a sample of " << sample_fps.size() << "." << endl;
+  if( num_hits < 1.0 ) {
+    cout << "None of the " << num_pairs << " sampled pairs were within the threshold." << endl;
+  } else {
+    cout << num_hits << " of the " << num_pairs << " sampled pairs were within the"
+         << " threshold, which is good to about " << int( hits_error( num_hits ) + 0.5 )
+         << "%." << endl;
+  }
+  cout << "Distance calculations : " << num_dists << endl
+       << "Neighbours : " << num_nbs << " , " << ( n > 0.0 ? num_nbs / n : 0.0 )
+       << " per fingerprint" << endl
+       << "Fingerprints : " << bytes_string( fps_bytes ) << " in each process" << endl
+       << "Neighbour lists with distances : " << bytes_string( nn_dists_bytes );
+  if( world_size > 1 && TAYLOR_BUTINA == cs.algorithm() ) {
+    cout << " , " << bytes_string( nn_dists_bytes / num_workers ) << " in each slave";
+  }
+  cout << endl
+       << "Neighbour lists for clustering : " << bytes_string( nns_bytes ) << endl
+       << "CPU time : " << time_string( cpu_secs ) << endl
+       << "Wall time : " << time_string( cpu_secs / ( num_workers * cs.num_threads() ) )
+       << " with " << num_workers << ( 1 == num_workers ? " process" : " processes" )
+       << " of " << cs.num_threads() << ( 1 == cs.num_threads() ? " thread" : " threads" )
+       << endl;
+
+  for( int i = 0 , is = sample_fps.size() ; i < is ; ++i ) {
+    delete sample_fps[i];
+  }
 
 }
 
@@ -1203,19 +2171,31 @@ int main( int argc , char **argv ) {
       cout << cs.usage_text() << endl;
       cerr << cs.error_message() << endl;
       cerr << cs.usage_text() << endl;
+      // the slaves are waiting to hear what to do
+      tell_slaves_finished( world_size );
       MPI_Finalize();
       exit( 1 );
     }
 
-    vector<string> seed_names , singleton_names;
-    if( 1 == world_size ) {
-      serial_run( cs , seed_names , singleton_names );
+    if( cs.estimate() ) {
+      if( world_size > 1 ) {
+        tell_slaves_finished( world_size );
+      }
+      estimate_run( cs , world_size );
+    } else if( LEADER == cs.algorithm() ) {
+      // the leader algorithm is threaded but not spread over processes
+      if( world_size > 1 ) {
+        tell_slaves_finished( world_size );
+      }
+      leader_run( cs );
+    } else if( 1 == world_size ) {
+      serial_run( cs );
+    } else if( !cs.read_nnlists_file().empty() ) {
+      // the expensive bit's already done, so the slaves aren't needed
+      tell_slaves_finished( world_size );
+      serial_run( cs );
     } else {
-      parallel_run( cs , world_size , seed_names , singleton_names );
-    }
-
-    if( cs.singletons_threshold() > cs.threshold() ) {
-      collapse_singletons( cs , seed_names , singleton_names );
+      parallel_run( cs , world_size );
     }
   } catch( ClusterInputFormatError &e ) {
     cerr << e.what() << endl;
@@ -1225,6 +2205,10 @@ int main( int argc , char **argv ) {
     cerr << e.what() << endl;
     MPI_Finalize();
     exit( 1 );
+  } catch( ClusterAlgorithmError &e ) {
+    cerr << e.what() << endl;
+    MPI_Finalize();
+    exit( 1 );
   } catch( DACLIB::FileReadOpenError &e ) {
     cerr << e.what() << endl;
     MPI_Finalize();
@@ -0,0 +1,231 @@
+//
+// file diverse_pick.cc
+// 19th October 2026
+//
+// Picks a diverse subset of fingerprints from a file using the MaxMin
+// algorithm: each pick is the fingerprint whose nearest previous pick is
+// furthest away.  It's done lazily, in the manner of Roger Sayle's picker in
+// RDKit.  Each candidate keeps the distance to its nearest pick so far and
+// the number of picks it's been compared with, and is only brought up to date
+// when it might be the next pick.  Since the distances can only go down as
+// picks are added, a candidate whose out-of-date distance is already no
+// better than the best found so far can be passed over.  Optionally, the
+// picks can be made diverse from a previously picked set as well.
+//
+// The output file has the name of each pick and the distance to its nearest
+// previous pick, in the order they were picked.
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include "DiversePickSettings.H"
+#include "FileExceptions.H"
+#include "FingerprintBase.H"
+#include "HashedFingerprint.H"
+#include "NotHashedFingerprint.H"
+#include "ParallelLoop.H"
+
+using namespace std;
+using namespace DAC_FINGERPRINTS;
+
+extern string BUILD_TIME;
+
+// the candidates are searched in chunks of this size, each chunk finding its
+// own best candidate.  The chunks don't depend on the number of threads, so
+// neither do the picks.
+static const unsigned int PICK_CHUNK_SIZE = 4096;
+
+// ****************************************************************************
+void read_fps( const string &filename , FP_FILE_FORMAT input_format ,
+               const string &bitstring_separator ,
+               vector<FingerprintBase *> &fps ) {
+
+  try {
+    read_fp_file( filename , input_format , bitstring_separator , fps );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+// the candidate in the chunk furthest from its nearest pick, as distance and
+// sequence number, with a sequence number of -1 if all the chunk's been picked.
+// Ties go to the lower sequence number.
+void best_in_chunk( const vector<FingerprintBase *> &fps ,
+                    const vector<FingerprintBase *> &picks ,
+                    const vector<char> &picked , unsigned int chunk ,
+                    vector<double> &min_dists ,
+                    vector<unsigned int> &num_checked ,
+                    vector<pair<double,int> > &chunk_bests ) {
+
+  int best_fp = -1;
+  double best_dist = -1.0;
+  unsigned int start = chunk * PICK_CHUNK_SIZE;
+  unsigned int finish = min( static_cast<unsigned int>( fps.size() ) ,
+                             start + PICK_CHUNK_SIZE );
+  for( unsigned int i = start ; i < finish ; ++i ) {
+    if( picked[i] || min_dists[i] <= best_dist ) {
+      continue;
+    }
+    unsigned int j = num_checked[i];
+    for( unsigned int js = picks.size() ; j < js ; ++j ) {
+      double dist = picks[j]->calc_distance( *fps[i] );
+      if( dist < min_dists[i] ) {
+        min_dists[i] = dist;
+        if( dist <= best_dist ) {
+          // it can't be the best now, so the rest can wait
+          ++j;
+          break;
+        }
+      }
+    }
+    num_checked[i] = j;
+    if( min_dists[i] > best_dist ) {
+      best_fp = i;
+      best_dist = min_dists[i];
+    }
+  }
+
+  chunk_bests[chunk] = make_pair( best_dist , best_fp );
+
+}
+
+// ****************************************************************************
+int next_pick( const vector<FingerprintBase *> &fps ,
+               const vector<FingerprintBase *> &picks ,
+               const vector<char> &picked , int num_threads ,
+               vector<double> &min_dists ,
+               vector<unsigned int> &num_checked , double &pick_dist ) {
+
+  unsigned int num_chunks = fps.size() / PICK_CHUNK_SIZE;
+  if( fps.size() % PICK_CHUNK_SIZE ) {
+    ++num_chunks;
+  }
+  vector<pair<double,int> > chunk_bests( num_chunks );
+  DACLIB::parallel_loop( num_chunks , num_threads ,
+                         boost::bind( &best_in_chunk , boost::cref( fps ) ,
+                                      boost::cref( picks ) , boost::cref( picked ) ,
+                                      _1 , boost::ref( min_dists ) ,
+                                      boost::ref( num_checked ) ,
+                                      boost::ref( chunk_bests ) ) , 1 );
+
+  int best_fp = -1;
+  pick_dist = -1.0;
+  for( unsigned int i = 0 ; i < num_chunks ; ++i ) {
+    if( -1 != chunk_bests[i].second && chunk_bests[i].first > pick_dist ) {
+      best_fp = chunk_bests[i].second;
+      pick_dist = chunk_bests[i].first;
+    }
+  }
+
+  return best_fp;
+
+}
+
+// ****************************************************************************
+int find_first_pick( const vector<FingerprintBase *> &fps ,
+                     const string &first_pick ) {
+
+  if( first_pick.empty() ) {
+    return 0;
+  }
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    if( fps[i]->get_name() == first_pick ) {
+      return i;
+    }
+  }
+
+  cerr << "Error : first pick " << first_pick << " not in input file." << endl;
+  cout << "Error : first pick " << first_pick << " not in input file." << endl;
+  exit( 1 );
+
+}
+
+// ****************************************************************************
+int main( int argc , char **argv ) {
+
+  cout << "diverse_pick - built " << BUILD_TIME << endl;
+
+  try {
+    DiversePickSettings dps( argc , argv );
+    if( !dps ) {
+      cout << dps.error_message() << endl << dps.usage_text() << endl;
+      cerr << dps.error_message() << endl << dps.usage_text() << endl;
+      exit( 1 );
+    }
+
+    ofstream ofs( dps.output_file().c_str() );
+    if( !ofs.good() ) {
+      cerr << "Couldn't open " << dps.output_file() << " for writing." << endl;
+      exit( 1 );
+    }
+
+    vector<FingerprintBase *> fps;
+    read_fps( dps.input_file() , dps.input_format() , dps.bitstring_separator() ,
+              fps );
+    if( dps.warm_feeling() ) {
+      cout << "Read " << fps.size() << " fingerprints to pick from." << endl;
+    }
+
+    // the seeds and the picks, which each candidate is compared with in turn
+    vector<FingerprintBase *> picks;
+    if( !dps.seed_file().empty() ) {
+      read_fps( dps.seed_file() , dps.input_format() , dps.bitstring_separator() ,
+                picks );
+      if( dps.warm_feeling() ) {
+        cout << "Read " << picks.size() << " previous picks." << endl;
+      }
+    }
+
+    vector<char> picked( fps.size() , 0 );
+    vector<double> min_dists( fps.size() , numeric_limits<double>::max() );
+    vector<unsigned int> num_checked( fps.size() , 0 );
+    int num_picked = 0;
+    if( picks.empty() && !fps.empty() ) {
+      // there's nothing to compare the first pick with, so it's given the
+      // maximum distance.
+      int first_pick = find_first_pick( fps , dps.first_pick() );
+      picked[first_pick] = 1;
+      picks.push_back( fps[first_pick] );
+      ofs << fps[first_pick]->get_name() << " " << 1.0 << endl;
+      ++num_picked;
+    }
+
+    while( num_picked < dps.num_picks() ) {
+      double pick_dist;
+      int pick = next_pick( fps , picks , picked , dps.num_threads() ,
+                            min_dists , num_checked , pick_dist );
+      if( -1 == pick ) {
+        break;
+      }
+      picked[pick] = 1;
+      picks.push_back( fps[pick] );
+      ofs << fps[pick]->get_name() << " " << pick_dist << endl;
+      ++num_picked;
+      if( dps.warm_feeling() && !( num_picked % 1000 ) ) {
+        cout << "Picked " << num_picked << " fingerprints, latest at distance "
+             << pick_dist << "." << endl;
+      }
+    }
+
+    cout << "Picked " << num_picked << " fingerprints from " << fps.size()
+         << "." << endl;
+  } catch( FingerprintInputFormatError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+}
@@ -0,0 +1,254 @@
+//
+// file hier_cluster.cc
+// 19th October 2026
+//
+// Single-linkage hierarchical clustering of a fingerprint file, giving the
+// full dendrogram rather than clusters at one threshold.  It's done by
+// building the minimum spanning tree with Prim's algorithm, calculating the
+// distances as they're needed, so the memory needed goes up with the number
+// of fingerprints, not its square.  Each step adds the fingerprint nearest
+// to the tree, then brings every other fingerprint's distance to the tree
+// up to date with it, which is done in parallel. The tree's edges in
+// ascending order of distance are then the merges of the dendrogram.
+//
+// The output file has one line per merge, in the order they happen, in the
+// same form as a SciPy linkage matrix: the 2 clusters merged, the distance
+// between them and the size of the new cluster.  The fingerprints are
+// clusters 0 to N-1, numbered in input file order, and the cluster made by
+// merge i (counting from 0) is cluster N+i.
+//
+// Tversky distances aren't symmetrical unless alpha is 0.5, so the smaller
+// of the 2 directions is used.
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include "FileExceptions.H"
+#include "FingerprintBase.H"
+#include "HashedFingerprint.H"
+#include "HierClusterSettings.H"
+#include "NotHashedFingerprint.H"
+#include "ParallelLoop.H"
+
+using namespace std;
+using namespace DAC_FINGERPRINTS;
+
+extern string BUILD_TIME;
+
+// the fingerprints are brought up to date in chunks of this size, each chunk
+// finding its own nearest fingerprint to the tree.  The chunks don't depend
+// on the number of threads, so neither does the tree.
+static const unsigned int TREE_CHUNK_SIZE = 1024;
+
+// an edge of the spanning tree, as distance and the 2 fingerprints
+typedef pair<double,pair<int,int> > TreeEdge;
+
+// ****************************************************************************
+double fp_distance( const FingerprintBase &fp1 , const FingerprintBase &fp2 ,
+                    bool tversky ) {
+
+  if( tversky ) {
+    return min( fp1.calc_distance( fp2 ) , fp2.calc_distance( fp1 ) );
+  }
+  return fp1.calc_distance( fp2 );
+
+}
+
+// ****************************************************************************
+// The Tanimoto distance between fingerprints with a and b bits set can't be
+// less than 1 - min(a,b)/max(a,b), so there's no point calculating it if
+// that's already no better than what we have.
+void update_chunk( const vector<FingerprintBase *> &fps ,
+                   const vector<int> &num_bits , bool tversky ,
+                   int new_fp , const vector<char> &in_tree ,
+                   unsigned int chunk , vector<double> &min_dists ,
+                   vector<int> &nearest ,
+                   vector<pair<double,int> > &chunk_nearest ) {
+
+  int best_fp = -1;
+  double best_dist = numeric_limits<double>::max();
+  unsigned int start = chunk * TREE_CHUNK_SIZE;
+  unsigned int finish = min( static_cast<unsigned int>( fps.size() ) ,
+                             start + TREE_CHUNK_SIZE );
+  for( unsigned int i = start ; i < finish ; ++i ) {
+    if( in_tree[i] ) {
+      continue;
+    }
+    bool do_calc = true;
+    if( !tversky ) {
+      int min_bits = min( num_bits[i] , num_bits[new_fp] );
+      int max_bits = max( num_bits[i] , num_bits[new_fp] );
+      double min_poss = max_bits ? 1.0 - double( min_bits ) / double( max_bits ) : 0.0;
+      do_calc = min_poss < min_dists[i];
+    }
+    if( do_calc ) {
+      double dist = fp_distance( *fps[new_fp] , *fps[i] , tversky );
+      if( dist < min_dists[i] ) {
+        min_dists[i] = dist;
+        nearest[i] = new_fp;
+      }
+    }
+    if( min_dists[i] < best_dist ) {
+      best_fp = i;
+      best_dist = min_dists[i];
+    }
+  }
+
+  chunk_nearest[chunk] = make_pair( best_dist , best_fp );
+
+}
+
+// ****************************************************************************
+void make_spanning_tree( const HierClusterSettings &hcs ,
+                         const vector<FingerprintBase *> &fps ,
+                         vector<TreeEdge> &tree ) {
+
+  if( fps.size() < 2 ) {
+    return;
+  }
+
+  // count_bits() may cache the count, so do them all before the threads start
+  vector<int> num_bits( fps.size() );
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    num_bits[i] = fps[i]->count_bits();
+  }
+
+  bool tversky = TVERSKY == hcs.similarity_calc();
+  unsigned int num_chunks = fps.size() / TREE_CHUNK_SIZE;
+  if( fps.size() % TREE_CHUNK_SIZE ) {
+    ++num_chunks;
+  }
+  vector<char> in_tree( fps.size() , 0 );
+  vector<double> min_dists( fps.size() , numeric_limits<double>::max() );
+  vector<int> nearest( fps.size() , -1 );
+  vector<pair<double,int> > chunk_nearest( num_chunks );
+
+  int new_fp = 0;
+  in_tree[new_fp] = 1;
+  tree.reserve( fps.size() - 1 );
+  for( unsigned int i = 1 , is = fps.size() ; i < is ; ++i ) {
+    DACLIB::parallel_loop( num_chunks , hcs.num_threads() ,
+                           boost::bind( &update_chunk , boost::cref( fps ) ,
+                                        boost::cref( num_bits ) , tversky ,
+                                        new_fp , boost::cref( in_tree ) , _1 ,
+                                        boost::ref( min_dists ) ,
+                                        boost::ref( nearest ) ,
+                                        boost::ref( chunk_nearest ) ) , 1 );
+    new_fp = -1;
+    double new_dist = numeric_limits<double>::max();
+    for( unsigned int j = 0 ; j < num_chunks ; ++j ) {
+      if( -1 != chunk_nearest[j].second && chunk_nearest[j].first < new_dist ) {
+        new_fp = chunk_nearest[j].second;
+        new_dist = chunk_nearest[j].first;
+      }
+    }
+    in_tree[new_fp] = 1;
+    tree.push_back( make_pair( new_dist , make_pair( nearest[new_fp] , new_fp ) ) );
+    if( hcs.warm_feeling() && !( i % 10000 ) ) {
+      cout << "Added " << i << " fingerprints to the spanning tree." << endl;
+    }
+  }
+
+}
+
+// ****************************************************************************
+int find_root( vector<int> &parents , int i ) {
+
+  while( parents[i] != i ) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+  }
+  return i;
+
+}
+
+// ****************************************************************************
+void write_dendrogram( unsigned int num_fps , vector<TreeEdge> &tree ,
+                       ostream &os ) {
+
+  stable_sort( tree.begin() , tree.end() ,
+               boost::bind( &TreeEdge::first , _1 ) < boost::bind( &TreeEdge::first , _2 ) );
+
+  // the cluster number and size for each union-find root
+  vector<int> parents( num_fps ) , clus_nums( num_fps ) , clus_sizes( num_fps , 1 );
+  for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+    parents[i] = i;
+    clus_nums[i] = i;
+  }
+
+  for( int i = 0 , is = tree.size() ; i < is ; ++i ) {
+    int root1 = find_root( parents , tree[i].second.first );
+    int root2 = find_root( parents , tree[i].second.second );
+    int clus1 = min( clus_nums[root1] , clus_nums[root2] );
+    int clus2 = max( clus_nums[root1] , clus_nums[root2] );
+    int new_size = clus_sizes[root1] + clus_sizes[root2];
+    os << clus1 << " " << clus2 << " " << tree[i].first << " " << new_size << endl;
+    parents[root2] = root1;
+    clus_nums[root1] = num_fps + i;
+    clus_sizes[root1] = new_size;
+  }
+
+}
+
+// ****************************************************************************
+int main( int argc , char **argv ) {
+
+  cout << "hier_cluster - built " << BUILD_TIME << endl;
+
+  try {
+    HierClusterSettings hcs( argc , argv );
+    if( !hcs ) {
+      cout << hcs.error_message() << endl << hcs.usage_text() << endl;
+      cerr << hcs.error_message() << endl << hcs.usage_text() << endl;
+      exit( 1 );
+    }
+
+    if( TVERSKY == hcs.similarity_calc() ) {
+      FingerprintBase::set_tversky_alpha( hcs.tversky_alpha() );
+      HashedFingerprint::set_similarity_calc( hcs.similarity_calc() );
+      NotHashedFingerprint::set_similarity_calc( hcs.similarity_calc() );
+    }
+
+    ofstream ofs( hcs.output_file().c_str() );
+    if( !ofs.good() ) {
+      cerr << "Couldn't open " << hcs.output_file() << " for writing." << endl;
+      exit( 1 );
+    }
+
+    vector<FingerprintBase *> fps;
+    try {
+      read_fp_file( hcs.input_file() , hcs.input_format() ,
+                    hcs.bitstring_separator() , fps );
+    } catch( DACLIB::FileReadOpenError &e ) {
+      cerr << e.what() << endl;
+      cout << e.what() << endl;
+      exit( 1 );
+    } catch( FingerprintFileError &e ) {
+      cerr << e.what() << endl;
+      cout << e.what() << endl;
+      exit( 1 );
+    }
+    if( hcs.warm_feeling() ) {
+      cout << "Read " << fps.size() << " fingerprints." << endl;
+    }
+
+    vector<TreeEdge> tree;
+    make_spanning_tree( hcs , fps , tree );
+    write_dendrogram( fps.size() , tree , ofs );
+
+    cout << "Made dendrogram of " << fps.size() << " fingerprints." << endl;
+  } catch( FingerprintInputFormatError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintDistCalcError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+}
@@ -5,15 +5,19 @@
 // 27th January 2014
 //
 // Takes 2 fingerprint files and does a histogram of distances between them.
+// By default, the bins are 0.05 wide, each including its lower edge, with
+// an extra one for distances of 1.0.  Other bin edges can be given as a
+// comma-separated list, in which case there's a bin below the first edge
+// and one from the last edge up.
 
 #include <functional>
 #include <numeric>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include "stddefs.H"
+#include "DistanceHistogram.H"
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
 #include "HashedFingerprint.H"
@@ -26,7 +30,7 @@ using namespace DAC_FINGERPRINTS;
 // ****************************************************************************
 int main( int argc , char **argv ) {
 
-  string usage( "./histogram {FLUSH_FPS|BITSTIRNGS} <PROBE_FILE> <TARGET_FILE> {start_num} {finish_num}" );
+  string usage( "./histogram {FLUSH_FPS|BITSTIRNGS} <PROBE_FILE> <TARGET_FILE> {start_num} {finish_num} {bin_edges}" );
 
   if( argc < 4 ) {
     cout << usage << endl;
@@ -56,14 +60,24 @@ int main( int argc , char **argv ) {
     finish = probe_fps.size();
   }
 
-  vector<double> hist_fracs( 21 , 0.0 );
-  for( unsigned int i = start ; i < finish ; ++i ) {
-    vector<unsigned int> dist_counts( 21 , 0 );
-    BOOST_FOREACH( FingerprintBase *tfp , target_fps ) {
-      double dist = probe_fps[i]->calc_distance( *tfp );
-      int i_dist = int( 20.0 * dist );
-      ++dist_counts[i_dist];
+  vector<double> bin_edges;
+  if( argc >= 7 ) {
+    try {
+      bin_edges = parse_bin_edges( string( argv[6] ) );
+    } catch( DistanceHistogramError &e ) {
+      cerr << e.what() << endl << usage << endl;
+      exit( 1 );
     }
+  }
+  // without edges, it's the usual steps of 0.05
+  DistanceHistogram hist = bin_edges.empty() ?
+      DistanceHistogram( 20 , false , TANIMOTO ) :
+      DistanceHistogram( bin_edges , false , TANIMOTO );
+
+  vector<double> hist_fracs( hist.num_bins() , 0.0 );
+  for( unsigned int i = start ; i < finish ; ++i ) {
+    vector<unsigned int> dist_counts( hist.num_bins() , 0 );
+    hist.add_distances( *probe_fps[i] , target_fps , &dist_counts[0] );
     for( int j = 0 , js = dist_counts.size() ; j < js ; ++j ) {
       hist_fracs[j] += double( dist_counts[j] ) / double( target_fps.size() );
     }
@@ -4,8 +4,10 @@
 // AstraZeneca
 // 28th May 2015
 //
-// This file contains stuff for passing STL strings with MPI
+// This file contains stuff for passing STL strings with MPI, and blocks of
+// bytes packed up by the caller.
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -61,4 +63,35 @@ void mpi_rec_strings_vector( int source_rank , std::vector<std::string> &strs )
 
 }
 
+// ****************************************************************************
+// MPI counts are ints, so a big block goes in pieces, after its size
+static const unsigned long long SEND_PIECE = 1 << 26;
+
+void send_block( const std::vector<char> &block , int dest_rank ) {
+
+  unsigned long long block_size = block.size();
+  MPI_Send( &block_size , 1 , MPI_UNSIGNED_LONG_LONG , dest_rank , 0 , MPI_COMM_WORLD );
+  for( unsigned long long i = 0 ; i < block_size ; i += SEND_PIECE ) {
+    int piece = std::min( SEND_PIECE , block_size - i );
+    MPI_Send( const_cast<char *>( &block[i] ) , piece , MPI_CHAR , dest_rank , 0 ,
+              MPI_COMM_WORLD );
+  }
+
+}
+
+// ****************************************************************************
+void receive_block( int source_rank , std::vector<char> &block ) {
+
+  unsigned long long block_size = 0;
+  MPI_Recv( &block_size , 1 , MPI_UNSIGNED_LONG_LONG , source_rank , 0 ,
+            MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  block.resize( block_size );
+  for( unsigned long long i = 0 ; i < block_size ; i += SEND_PIECE ) {
+    int piece = std::min( SEND_PIECE , block_size - i );
+    MPI_Recv( &block[i] , piece , MPI_CHAR , source_rank , 0 , MPI_COMM_WORLD ,
+              MPI_STATUS_IGNORE );
+  }
+
+}
+
 }
@@ -0,0 +1,198 @@
+//
+// file nnlists_to_text.cc
+// 19th October 2026
+//
+// Turns a neighbour lists file, as written by satan with --output-format
+// BINARY or by cluster with --write-nnlists-file, into satan's SATAN or
+// NNLISTS text.
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "FileExceptions.H"
+#include "NNListsFile.H"
+#include "SatanTextOutput.H"
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+using namespace std;
+using namespace DAC_FINGERPRINTS;
+namespace po = boost::program_options;
+
+extern string BUILD_TIME;
+
+// ****************************************************************************
+void build_program_options( po::options_description &desc ,
+                            string &input_file , string &output_file ,
+                            string &output_format , int &chunk_size ,
+                            bool &warm_feeling ) {
+
+  desc.add_options()
+      ( "help" , "Produce help text." )
+      ( "input-file,I" , po::value<string>( &input_file ) ,
+        "Input neighbour lists file." )
+      ( "output-file,O" , po::value<string>( &output_file ) , "Output filename" )
+      ( "output-format" , po::value<string>( &output_format ) ,
+        "Output format : SATAN|NNLISTS (default SATAN)" )
+      ( "probe-chunk-size" , po::value<int>( &chunk_size ) ,
+        "The NNLISTS padding is worked out for this many probes at a time, as satan does for its chunks of probes. Defaults to all the probes at once, as in a serial satan run." )
+      ( "verbose,V" , po::value<bool>( &warm_feeling )->zero_tokens() ,
+        "Verbose mode" )
+      ( "warm-feeling,W" , po::value<bool>( &warm_feeling )->zero_tokens() ,
+        "Verbose mode" );
+
+}
+
+// ****************************************************************************
+void verify_program_options( po::options_description &desc ,
+                             po::variables_map &vm , int argc ,
+                             const string &output_format , int chunk_size ) {
+
+  if( 1 == argc || vm.count( "help" ) ) {
+    cout << desc << endl;
+    exit( 1 );
+  }
+
+  if( !vm.count( "input-file" ) ) {
+    cerr << "Need an input neighbour lists file." << endl << desc << endl;
+    exit( 1 );
+  }
+
+  if( !vm.count( "output-file" ) ) {
+    cerr << "Need an output_file." << endl << desc << endl;
+    exit( 1 );
+  }
+
+  if( string( "SATAN" ) != output_format && string( "NNLISTS" ) != output_format ) {
+    cerr << "Invalid output format " << output_format
+         << ". Must be one of SATAN or NNLISTS." << endl;
+    exit( 1 );
+  }
+
+  if( chunk_size < 1 ) {
+    cerr << "Probe chunk size must be at least 1." << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+// If the lists are for the fingerprints in the file themselves, each was
+// written without the fingerprint, so it goes back in, at distance 0.0,
+// where satan has it.
+void add_nnlist( const vector<string> &fp_names ,
+                 const vector<string> &probe_names , int fp_num ,
+                 const NNList &nnl ,
+                 vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  bool same_set = probe_names.empty();
+  nbs.push_back( make_pair( same_set ? fp_names[fp_num] : probe_names[fp_num] ,
+                            vector<pair<string,double> >() ) );
+  vector<pair<string,double> > &probe_nbs = nbs.back().second;
+  probe_nbs.reserve( nnl.size() + 1 );
+  if( same_set ) {
+    probe_nbs.push_back( make_pair( fp_names[fp_num] , 0.0 ) );
+  }
+  for( unsigned int j = 0 , js = nnl.size() ; j < js ; ++j ) {
+    probe_nbs.push_back( make_pair( fp_names[nnl[j].first] ,
+                                    double( nnl[j].second ) ) );
+  }
+  if( same_set ) {
+    sort( probe_nbs.begin() , probe_nbs.end() , SortNbsByDist() );
+  }
+
+}
+
+// ****************************************************************************
+int main( int argc , char **argv ) {
+
+  cout << "nnlists_to_text - built " << BUILD_TIME << endl;
+
+  string input_file , output_file , output_format( "SATAN" );
+  int chunk_size = numeric_limits<int>::max();
+  bool warm_feeling( false );
+  po::options_description desc( "Allowed Options" );
+  build_program_options( desc , input_file , output_file , output_format ,
+                         chunk_size , warm_feeling );
+
+  po::variables_map vm;
+  try {
+    po::store( po::parse_command_line( argc , argv , desc ) , vm );
+  } catch( po::error &e ) {
+    cerr << "Error parsing command line : " << e.what() << endl;
+    exit( 1 );
+  }
+  po::notify( vm );
+
+  verify_program_options( desc , vm , argc , output_format , chunk_size );
+
+  double threshold;
+  vector<string> fp_names , probe_names;
+  bool byte_swapping = false;
+  gzFile gzfp;
+  try {
+    open_nnlists_file_for_reading( input_file , threshold , fp_names ,
+                                   probe_names , byte_swapping , gzfp );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  } catch( NNListsFileError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+  ofstream output_stream( output_file.c_str() );
+  if( !output_stream.good() ) {
+    cerr << "Couldn't open " << output_file << " for writing." << endl;
+    exit( 1 );
+  }
+
+  // the lists are written a probe chunk at a time, by probe number
+  int num_probes = probe_names.empty() ? fp_names.size() : probe_names.size();
+  int fp_num , chunk_num = 0 , num_lists = 0;
+  NNList nnl;
+  vector<pair<string,vector<pair<string,double> > > > nbs;
+  while( 1 ) {
+    try {
+      if( !read_next_nnlist( input_file , gzfp , byte_swapping , fp_num , nnl ) ) {
+        break;
+      }
+    } catch( NNListsFileError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
+    }
+    bool bad_list = fp_num < 0 || fp_num >= num_probes;
+    for( unsigned int j = 0 , js = nnl.size() ; j < js ; ++j ) {
+      if( nnl[j].first < 0 || nnl[j].first >= int( fp_names.size() ) ) {
+        bad_list = true;
+      }
+    }
+    if( bad_list ) {
+      cerr << "Bad neighbour list for fingerprint number " << fp_num
+           << " in " << input_file << endl;
+      exit( 1 );
+    }
+    if( fp_num / chunk_size != chunk_num ) {
+      output_neighbours( 0 , output_format , output_stream , nbs );
+      nbs.clear();
+      chunk_num = fp_num / chunk_size;
+    }
+    add_nnlist( fp_names , probe_names , fp_num , nnl , nbs );
+    ++num_lists;
+  }
+  output_neighbours( 0 , output_format , output_stream , nbs );
+  gzclose( gzfp );
+
+  if( warm_feeling ) {
+    cout << "Wrote " << num_lists << " neighbour lists made at threshold "
+         << threshold << " to " << output_file << endl;
+  }
+
+}
@@ -170,6 +170,7 @@ int main( int argc , char **argv ) {
   if( warm_feeling ) {
     cout << "Read " << fps.size() << " fingerprints" << endl;
   }
+  close_fp_file_for_reading( gzfp );
 
   gzfp = 0; // for binary formats
   FILE *ucfp = 0;
@@ -187,6 +188,4 @@ int main( int argc , char **argv ) {
     fclose( ucfp );
   }
 
-  gzclose( gzfp );
-
 }
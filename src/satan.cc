@@ -8,10 +8,14 @@
 // in the first that have at least a given number of fingerprints in the second
 // within a threshold tanimoto distance.
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <numeric> // for the accumulate algorithm
 #include <sstream>
 #include <vector>
@@ -20,12 +24,20 @@
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/thread.hpp>
 
+#include "DistanceHistogram.H"
+#include "FPBlockRing.H"
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
 #include "HashedFingerprint.H"
 #include "NotHashedFingerprint.H"
+#include "NNListsFile.H"
+#include "ParallelLoop.H"
+#include "RunEstimate.H"
 #include "SatanSettings.H"
+#include "SatanTextOutput.H"
 #include "chrono.h"
 
 #include <mpi.h>
@@ -34,17 +46,6 @@ using namespace boost;
 using namespace std;
 using namespace DAC_FINGERPRINTS;
 
-class SortNbsByDist :
-    public binary_function<pair<string,double> , pair<string,double> , bool> {
-public :
-  result_type operator()( first_argument_type a , second_argument_type b ) const {
-    if( a.second == b.second )
-      return a.first < b.first;
-    else
-      return a.second < b.second;
-  }
-};
-
 // in eponymous file
 namespace DACLIB {
 string get_cwd();
@@ -52,6 +53,8 @@ string get_cwd();
 // In mpi_string_subs.cc
 void mpi_send_string( const string &str , int dest_rank );
 void mpi_rec_string( int source_rank , string &str );
+void send_block( const vector<char> &block , int dest_rank );
+void receive_block( int source_rank , vector<char> &block );
 }
 
 extern string BUILD_TIME; // in build_time.cc
@@ -59,638 +62,1683 @@ extern string BUILD_TIME; // in build_time.cc
 // static const int FP_CHUNK_SIZE = 500000;
 
 // ****************************************************************************
-void output_neighbours_satan( unsigned int min_count ,
-                              ostream &output_stream ,
-                              vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+void dump_fps( vector<FingerprintBase *> &fps ) {
 
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    if( min_count && (nbs[i].second).size() >= min_count ) {
-      for( unsigned int j = 0 ; j < min_count ; ++j ) {
-        output_stream << nbs[i].first << " "
-                      << (nbs[i].second)[j].first << " "
-                      << (nbs[i].second)[j].second << endl;
-      }
-    }
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    delete fps[i];
   }
+  fps.clear();
 
 }
 
 // ****************************************************************************
-void output_neighbours_satan( ostream &output_stream ,
-                              vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+void open_fp_file( const string &filename ,
+                   DAC_FINGERPRINTS::FP_FILE_FORMAT input_format ,
+                   bool &byteswapping  , gzFile &pfile) {
 
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    for( unsigned int j = 0 , js = (nbs[i].second).size() ; j < js ; ++j ) {
-      output_stream << nbs[i].first << " "
-                    << (nbs[i].second)[j].first << " "
-                    << (nbs[i].second)[j].second << endl;
+  byteswapping = false;
+  try {
+    open_fp_file_for_reading( filename , input_format ,
+                              byteswapping , pfile );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+// the number of blocks of targets that can be in memory at once, so the
+// reader can be this many less 1 blocks ahead of the slowest worker
+static const unsigned int TARGET_RING_SIZE = 3;
+
+// ****************************************************************************
+// probe i against a block of targets.  Each probe's neighbour list is only
+// touched by the thread doing that probe, and the targets are done in file
+// order, so the results are the same whatever the number of threads.
+void probe_against_targets( const vector<FingerprintBase *> &target_fps ,
+                            const vector<FingerprintBase *> &probe_fps ,
+                            double threshold , unsigned int min_count ,
+                            unsigned int i ,
+                            vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  vector<pair<string,double> > &probe_nbs = nbs[i].second;
+  for( int j = 0 , js = target_fps.size() ; j < js ; ++j ) {
+    if( min_count && probe_nbs.size() >= min_count ) {
+      break;
+    }
+    double dist = target_fps[j]->calc_distance( *(probe_fps[i] ) , threshold );
+    if( dist <= threshold ) {
+      probe_nbs.push_back( make_pair( target_fps[j]->get_name() , dist ) );
     }
   }
 
 }
 
 // ****************************************************************************
-unsigned int max_probe_name_len( const vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+// In COUNTS mode a probe isn't counted against a target of the same name.
+// Comparing the names for every pair costs more than the distance, so each
+// probe name is given a number once, and each target the number of the probe
+// with its name, if there is one, once per block.  Then the test is an
+// integer comparison.  Probes with the same name get the same number.
+typedef boost::unordered_map<string,unsigned int> NameIds;
+static const unsigned int NO_NAME_ID = numeric_limits<unsigned int>::max();
 
-  unsigned int max_len = 0;
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    if( (nbs[i].first).length() > max_len ) {
-      max_len = (nbs[i].first).length();
+// ****************************************************************************
+void make_probe_name_ids( const vector<FingerprintBase *> &probe_fps ,
+                          NameIds &name_ids ,
+                          vector<unsigned int> &probe_name_ids ) {
+
+  name_ids.clear();
+  probe_name_ids.clear();
+  probe_name_ids.reserve( probe_fps.size() );
+  for( unsigned int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
+    probe_name_ids.push_back( name_ids.insert( make_pair( probe_fps[i]->get_name() ,
+                                                          i ) ).first->second );
+  }
+
+}
+
+// ****************************************************************************
+void make_target_name_ids( const vector<FingerprintBase *> &target_fps ,
+                           const NameIds &name_ids ,
+                           vector<unsigned int> &target_name_ids ) {
+
+  target_name_ids.clear();
+  target_name_ids.reserve( target_fps.size() );
+  for( unsigned int j = 0 , js = target_fps.size() ; j < js ; ++j ) {
+    NameIds::const_iterator p = name_ids.find( target_fps[j]->get_name() );
+    target_name_ids.push_back( name_ids.end() == p ? NO_NAME_ID : p->second );
+  }
+
+}
+
+// ****************************************************************************
+// the COUNTS bins are tenths of the distance, each going up to and including
+// its upper edge, so a distance of 0.44 goes in bin 4 and 0.4 in bin 3.
+// For the other output formats, it's an empty histogram that costs nothing
+// to make.
+DistanceHistogram make_counts_histogram( const SatanSettings &ss ) {
+
+  unsigned int num_steps = string( "COUNTS" ) == ss.output_format() ? 10 : 0;
+  return DistanceHistogram( num_steps , true , ss.similarity_calc() );
+
+}
+
+// ****************************************************************************
+// what a COUNTS search needs besides the fingerprints, made once for a set
+// of probes.  For the other output formats, it's empty.
+struct CountsSearch {
+
+  CountsSearch( const SatanSettings &ss ,
+                const vector<FingerprintBase *> &probe_fps ) :
+    hist_( make_counts_histogram( ss ) ) {
+    if( string( "COUNTS" ) == ss.output_format() ) {
+      make_probe_name_ids( probe_fps , name_ids_ , probe_name_ids_ );
     }
   }
 
-  return max_len;
+  DistanceHistogram hist_;
+  NameIds name_ids_;
+  vector<unsigned int> probe_name_ids_;
+
+};
+
+// ****************************************************************************
+// the counts version.  Traditionally, we don't report the compound with
+// itself.
+void probe_counts_against_targets( const CountsSearch &counts_search ,
+                                   const vector<FingerprintBase *> &target_fps ,
+                                   const vector<unsigned int> &target_name_ids ,
+                                   const vector<FingerprintBase *> &probe_fps ,
+                                   unsigned int i ,
+                                   vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  counts_search.hist_.add_distances( *probe_fps[i] ,
+                                     counts_search.probe_name_ids_[i] ,
+                                     target_fps , &target_name_ids[0] ,
+                                     &counts[i].second[0] );
 
 }
 
 // ****************************************************************************
-unsigned int max_target_name_len( const vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+// a worker thread's probes, first_probe to last_probe - 1, against each
+// block of targets in turn.  Only this thread touches these probes' results.
+// With a min_count, a probe is finished once it has that many neighbours,
+// so only the probes still short of them are kept, and once there are none
+// left the thread leaves the ring, which stops reading the targets when all
+// the threads have.
+void probes_against_target_blocks( const SatanSettings &ss ,
+                                   const vector<FingerprintBase *> &probe_fps ,
+                                   unsigned int first_probe ,
+                                   unsigned int last_probe ,
+                                   const CountsSearch &counts_search ,
+                                   FPBlockRing &target_ring ,
+                                   vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                                   vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  bool counts_output = string( "COUNTS" ) == ss.output_format();
+  unsigned int min_count = counts_output ? 0 : ss.min_count();
+  vector<unsigned int> probes_to_do;
+  for( unsigned int i = first_probe ; i < last_probe ; ++i ) {
+    probes_to_do.push_back( i );
+  }
+  vector<unsigned int> target_name_ids;
+  for( unsigned int block_num = 0 ; ; ++block_num ) {
+    const vector<FingerprintBase *> *target_fps = target_ring.get_block( block_num );
+    if( !target_fps ) {
+      break;
+    }
+    if( counts_output ) {
+      make_target_name_ids( *target_fps , counts_search.name_ids_ ,
+                            target_name_ids );
+    }
+    BOOST_FOREACH( unsigned int i , probes_to_do ) {
+      if( counts_output ) {
+        probe_counts_against_targets( counts_search , *target_fps ,
+                                      target_name_ids , probe_fps , i , counts );
+      } else {
+        probe_against_targets( *target_fps , probe_fps , ss.threshold() ,
+                               min_count , i , nbs );
+      }
+    }
+    target_ring.release_block( block_num );
 
-  unsigned int max_len = 0;
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    for( int k = 0 , ks = (nbs[i].second).size() ; k < ks ; ++k ) {
-      if( (nbs[i].second)[k].first.length() > max_len ) {
-        max_len = (nbs[i].second)[k].first.length();
+    if( min_count ) {
+      unsigned int num_left = 0;
+      BOOST_FOREACH( unsigned int i , probes_to_do ) {
+        if( nbs[i].second.size() < min_count ) {
+          probes_to_do[num_left++] = i;
+        }
+      }
+      probes_to_do.resize( num_left );
+      if( probes_to_do.empty() ) {
+        target_ring.finish_consumer( block_num + 1 );
+        break;
       }
     }
   }
 
-  return max_len;
+}
+
+// ****************************************************************************
+// search the probes against all the targets, filling nbs or counts
+void search_probes( const SatanSettings &ss ,
+                    const vector<FingerprintBase *> &probe_fps ,
+                    vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                    vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  gzFile tfile;
+  bool target_byteswapping;
+  CountsSearch counts_search( ss , probe_fps );
+
+  if( string( "COUNTS" ) == ss.output_format() ) {
+    counts.reserve( probe_fps.size() );
+    BOOST_FOREACH( FingerprintBase *pfp , probe_fps ) {
+      counts.push_back( make_pair( pfp->get_name() , vector<unsigned int>( 10 , 0 ) ) );
+    }
+  } else {
+    nbs.reserve( probe_fps.size() );
+    BOOST_FOREACH( FingerprintBase *pfp , probe_fps ) {
+      nbs.push_back( make_pair( pfp->get_name() , vector<pair<string,double> >() ) );
+    }
+  }
+
+  open_fp_file( ss.target_file() , ss.input_format() , target_byteswapping , tfile );
+
+  // one thread reads the targets in blocks into the ring, and each worker
+  // thread does its own slice of the probes against every block.
+  unsigned int num_workers = min( static_cast<unsigned int>( ss.num_threads() ) ,
+                                  static_cast<unsigned int>( probe_fps.size() ) );
+  FPBlockRing target_ring( tfile , target_byteswapping , ss.input_format() ,
+                           ss.bitstring_separator() , ss.target_block_size() ,
+                           TARGET_RING_SIZE , num_workers );
+  boost::thread_group threads;
+  threads.create_thread( boost::bind( &FPBlockRing::read_blocks , &target_ring ) );
+  for( unsigned int i = 0 ; i < num_workers ; ++i ) {
+    unsigned int first_probe = i * probe_fps.size() / num_workers;
+    unsigned int last_probe = ( i + 1 ) * probe_fps.size() / num_workers;
+    threads.create_thread( boost::bind( &probes_against_target_blocks ,
+                                        boost::cref( ss ) , boost::cref( probe_fps ) ,
+                                        first_probe , last_probe ,
+                                        boost::cref( counts_search ) ,
+                                        boost::ref( target_ring ) ,
+                                        boost::ref( nbs ) , boost::ref( counts ) ) );
+  }
+  threads.join_all();
+
+  // if the workers waited for targets, it was the reading that held things
+  // up, if the reader waited for free slots, it was the searching.
+  if( ss.warm_feeling() ) {
+    cout << "Reading targets took " << target_ring.read_secs() << " s, and "
+         << target_ring.reader_wait_secs() << " s waiting for the searching"
+         << " (compute-bound).  Workers waited "
+         << target_ring.consumer_wait_secs() / double( num_workers )
+         << " s each on average for targets (I/O-bound)." << endl;
+    if( target_ring.stopped_early() ) {
+      cout << "All the probes had " << ss.min_count() << " neighbours after "
+           << target_ring.num_blocks_read() << " blocks of targets, so the"
+           << " rest weren't read." << endl;
+    }
+  }
+
+  close_fp_file_for_reading( tfile );
+
+  // sort the neighbour lists ready for output
+  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    sort( nbs[i].second.begin() , nbs[i].second.end() , SortNbsByDist() );
+  }
+
+}
+
+// ****************************************************************************
+// search a chunk of probes, sent by the master, against the targets
+void process_fingerprints( const SatanSettings &ss ,
+                           vector<FingerprintBase *> &probe_fps ,
+                           vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                           vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  if( ss.warm_feeling() ) {
+    cout << "Received " << probe_fps.size() << " probes." << endl;
+  }
+
+  search_probes( ss , probe_fps , nbs , counts );
+
+  // we're done with probes
+  dump_fps( probe_fps );
 
 }
 
 // ****************************************************************************
-unsigned int max_count_name_len( const vector<pair<string,vector<unsigned int> > > &counts ) {
+// Where the results go.  The text formats go to the output file as they
+// always have.  BINARY goes to a neighbour lists file (NNListsFile.H),
+// compressed if the output file name ends in .gz, with the target names in
+// the header and each neighbour given by its target's number.  The number
+// comes from the name, so a name that's in the target file more than once
+// always gets the number of its first appearance.  The records are numbered
+// by the probes' positions in the probe file, which is the order they're
+// written in.  If the probe file is the target file, there's no min_count
+// and the names are all different, the probe names aren't written and a
+// probe isn't put in its own list, so that cluster can read the file.
+// Otherwise, the lists are the ones the text formats would have.
+class SatanOutput {
+
+public :
+
+  // exits if the file can't be opened or written
+  explicit SatanOutput( const SatanSettings &ss );
+  ~SatanOutput();
+
+  void write_neighbours( vector<pair<string,vector<pair<string,double> > > > &nbs );
+  void write_counts( vector<pair<string,vector<unsigned int> > > &counts );
+
+private :
+
+  unsigned int min_count_;
+  string output_format_;
+  string output_file_;
+  ofstream text_stream_;
+  gzFile binary_file_;
+  NameIds target_nums_;
+  bool same_set_;
+  int next_probe_num_;
+
+  void write_binary_neighbours( const vector<pair<string,vector<pair<string,double> > > > &nbs );
+
+  // no copying
+  SatanOutput( const SatanOutput & );
+  SatanOutput &operator=( const SatanOutput & );
+
+};
+
+// ****************************************************************************
+SatanOutput::SatanOutput( const SatanSettings &ss ) :
+  min_count_( ss.min_count() ) , output_format_( ss.output_format() ) ,
+  output_file_( ss.output_file() ) , binary_file_( 0 ) ,
+  same_set_( ss.probe_file() == ss.target_file() && !ss.min_count() ) ,
+  next_probe_num_( 0 ) {
+
+  if( string( "BINARY" ) != output_format_ ) {
+    text_stream_.open( ss.output_file().c_str() );
+    if( !text_stream_.good() ) {
+      cerr << "Couldn't open " << ss.output_file() << " for writing." << endl;
+      exit( 1 );
+    }
+    return;
+  }
+
+  vector<string> target_names , probe_names;
+  try {
+    get_fp_names( ss.target_file() , ss.input_format() , ss.bitstring_separator() ,
+                  target_names );
+    if( !same_set_ ) {
+      get_fp_names( ss.probe_file() , ss.input_format() , ss.bitstring_separator() ,
+                    probe_names );
+    }
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
+  // if names are repeated, the numbers can't always be the right ones, so
+  // the probe names are written and the lists are left as they are.
+  for( unsigned int i = 0 , is = target_names.size() ; i < is ; ++i ) {
+    if( !target_nums_.insert( make_pair( target_names[i] , i ) ).second && same_set_ ) {
+      same_set_ = false;
+      probe_names = target_names;
+    }
+  }
 
-  unsigned int max_len = 0;
-  typedef pair<string,vector<unsigned int> > SVUI;
-  BOOST_FOREACH( SVUI cnt , counts ) {
-    if( cnt.first.length() > max_len ) {
-      max_len = cnt.first.length();
+  const string &output_file = ss.output_file();
+  bool compress = output_file.length() > 3 &&
+      string( ".gz" ) == output_file.substr( output_file.length() - 3 );
+  try {
+    open_nnlists_file_for_writing( output_file , ss.threshold() , target_names ,
+                                   probe_names , compress , binary_file_ );
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << "Couldn't open " << output_file << " for writing." << endl;
+    exit( 1 );
+  } catch( NNListsFileError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+// the output's no good if the end of it can't be written, so it's treated
+// like a failure to write any of the rest.
+SatanOutput::~SatanOutput() {
+
+  if( binary_file_ ) {
+    try {
+      close_nnlists_file( output_file_ , binary_file_ );
+    } catch( NNListsFileError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
     }
   }
 
-  return max_len;
 }
 
 // ****************************************************************************
-void pad_spaces( unsigned int str_len , unsigned int max_len ,
-                 bool with_colon , ostream &output_stream ) {
+void SatanOutput::write_neighbours( vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  if( binary_file_ ) {
+    write_binary_neighbours( nbs );
+  } else {
+    output_neighbours( min_count_ , output_format_ , text_stream_ , nbs );
+  }
+
+}
+
+// ****************************************************************************
+void SatanOutput::write_counts( vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  output_counts( text_stream_ , counts );
+
+}
 
-  // this is the way that snailflush does it - I can't remember why, but I
-  // know there ought to be a better way.
-  for( unsigned int i = str_len ; i <= max_len ; ++i ) {
-    output_stream << " ";
+// ****************************************************************************
+// cluster breaks distance ties on the higher sequence number first
+static bool cluster_nnlist_order( const pair<int,float> &a , const pair<int,float> &b ) {
+
+  if( a.second == b.second ) {
+    return a.first > b.first;
+  } else {
+    return a.second < b.second;
   }
-  if( with_colon ) {
-    output_stream << "  : ";
+
+}
+
+// ****************************************************************************
+// as with the text formats, with a min_count only the probes with enough
+// neighbours are written, with the first min_count of them.
+void SatanOutput::write_binary_neighbours( const vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  NNList nnl;
+  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    int probe_num = next_probe_num_++;
+    const vector<pair<string,double> > &probe_nbs = nbs[i].second;
+    if( min_count_ && probe_nbs.size() < min_count_ ) {
+      continue;
+    }
+    unsigned int num_nbs = min_count_ ? min_count_ : probe_nbs.size();
+    nnl.clear();
+    bool left_out_probe = !same_set_;
+    for( unsigned int j = 0 ; j < num_nbs ; ++j ) {
+      NameIds::const_iterator p = target_nums_.find( probe_nbs[j].first );
+      if( target_nums_.end() == p ) {
+        continue;
+      }
+      // only the probe itself is left out, not others with its name
+      if( !left_out_probe && int( p->second ) == probe_num ) {
+        left_out_probe = true;
+        continue;
+      }
+      nnl.push_back( make_pair( int( p->second ) , float( probe_nbs[j].second ) ) );
+    }
+    if( same_set_ ) {
+      sort( nnl.begin() , nnl.end() , cluster_nnlist_order );
+    }
+    try {
+      write_nnlist( output_file_ , binary_file_ , probe_num , nnl );
+    } catch( NNListsFileError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
+    }
   }
 
 }
 
 // ****************************************************************************
-void output_neighbours_nnlists( unsigned int min_count ,
-                                ostream &output_stream ,
-                                vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+void serial_run( const SatanSettings &ss ) {
 
-  // snailflush pads the nnlists with spaces so all records are the same length.
-  // Do the same here for consistency, but bearing in mind that it might
-  // not be completely kosher as the probes are being done in batches.
-  unsigned int max_probe_len = max_probe_name_len( nbs );
-  unsigned int max_target_len = max_target_name_len( nbs );
+  // open the output right away, in case we can't. It's best to find
+  // out before we've done a potentially long job.
+  SatanOutput output( ss );
+
+  // the probes are done a chunk at a time, and each chunk's results are
+  // written before the next chunk is read, so the memory needed doesn't
+  // depend on the number of probes.
+  unsigned int chunk_size = numeric_limits<unsigned int>::max();
+  if( ss.probe_chunk_size() > 0 ) {
+    chunk_size = ss.probe_chunk_size();
+  }
 
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    if( min_count && (nbs[i].second).size() >= min_count ) {
-      output_stream << nbs[i].first;
-      pad_spaces( nbs[i].first.length() , max_probe_len , true , output_stream );
-      output_stream << endl;
-
-      for( unsigned int j = 0 ; j < min_count ; ++j ) {
-        // for nnlists, by tradition we don't output the neighbour if it appears
-        // to be the same molecule
-        if( (nbs[i].second)[j].second == 0.0F &&
-            (nbs[i].second)[j].first == nbs[i].first ) {
-          continue;
-        }
-        output_stream << "      " << (nbs[i].second)[j].first;
-        pad_spaces( (nbs[i].second)[j].first.length() , max_target_len ,
-                    true , output_stream );
-        output_stream << setw( 6 ) << setprecision( 4 )
-                      << setiosflags( ios::showpoint )
-                      << (nbs[i].second)[j].second << endl;
+  gzFile pfile;
+  bool probe_byteswapping;
+  open_fp_file( ss.probe_file() , ss.input_format() , probe_byteswapping , pfile );
+  for( int chunk_num = 0 ; ; ++chunk_num ) {
+    vector<FingerprintBase *> probe_fps;
+    read_fps_from_file( pfile , probe_byteswapping , ss.input_format() ,
+                        ss.bitstring_separator() , 0 , chunk_size , probe_fps );
+    if( probe_fps.empty() ) {
+      if( !chunk_num ) {
+        cerr << "Error : premature end of file " << ss.probe_file() << endl;
+        close_fp_file_for_reading( pfile );
+        exit( 1 );
       }
-      output_stream << endl;
+      break;
+    }
+    if( ss.warm_feeling() ) {
+      cout << "Read " << probe_fps.size() << " probes." << endl;
+    }
+
+    vector<pair<string,vector<pair<string,double> > > > nbs;
+    vector<pair<string,vector<unsigned int> > > counts;
+    search_probes( ss , probe_fps , nbs , counts );
+    dump_fps( probe_fps );
+    if( !nbs.empty() ) {
+      output.write_neighbours( nbs );
+    }
+    if( !counts.empty( ) ){
+      output.write_counts( counts );
     }
   }
+  close_fp_file_for_reading( pfile );
 
 }
 
 // ****************************************************************************
-void output_neighbours_nnlists( ostream &output_stream ,
-                                vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+void tell_master_slave_has_done_nnlists() {
 
-  // snailflush pads the nnlists with spaces so all records are the same length.
-  // Do the same here for consistency, but bearing in mind that it might
-  // not be completely kosher as the probes are being done in batches.
-  unsigned int max_probe_len = max_probe_name_len( nbs );
-  unsigned int max_target_len = max_target_name_len( nbs );
+  // tell the master we're finished.  It'll then pick the results up in
+  // the correct order.
+  DACLIB::mpi_send_string( string( "Slave_Finished" ) , 0 );
 
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    output_stream << nbs[i].first;
-    pad_spaces( nbs[i].first.length() , max_probe_len , true , output_stream );
-    output_stream << endl;
-
-    for( unsigned int j = 0 , js = (nbs[i].second).size() ; j < js ; ++j ) {
-      // for nnlists, by tradition we don't output the neighbour if it appears
-      // to be the same molecule
-      if( (nbs[i].second)[j].second == 0.0F &&
-          (nbs[i].second)[j].first == nbs[i].first ) {
-        continue;
+}
+
+// ****************************************************************************
+template <typename T>
+void pack_value( const T &val , vector<char> &block ) {
+
+  const char *vc = reinterpret_cast<const char *>( &val );
+  block.insert( block.end() , vc , vc + sizeof( T ) );
+
+}
+
+// ****************************************************************************
+template <typename T>
+T unpack_value( const vector<char> &block , size_t &pos ) {
+
+  T val;
+  memcpy( &val , &block[pos] , sizeof( T ) );
+  pos += sizeof( T );
+  return val;
+
+}
+
+// ****************************************************************************
+void pack_string( const string &str , vector<char> &block ) {
+
+  pack_value( static_cast<unsigned int>( str.length() ) , block );
+  block.insert( block.end() , str.begin() , str.end() );
+
+}
+
+// ****************************************************************************
+string unpack_string( const vector<char> &block , size_t &pos ) {
+
+  unsigned int len = unpack_value<unsigned int>( block , pos );
+  string str( &block[0] + pos , len );
+  pos += len;
+  return str;
+
+}
+
+// ****************************************************************************
+// The results for a chunk go to the master as one block, rather than a
+// message for every name and distance.  For neighbour lists, the block is
+// the chunk number, the number of probes and a table of the distinct
+// names, each once, and then for each probe the index of its name, the
+// number of neighbours, their name indices and their distances.  A target
+// that is a neighbour of many probes in the chunk is only sent once.
+void pack_nnlists_results( int chunk_num ,
+                           const vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                           vector<char> &block ) {
+
+  NameIds name_ids;
+  vector<const string *> names;
+  vector<unsigned int> name_nums;
+  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    for( int j = -1 , js = nbs[i].second.size() ; j < js ; ++j ) {
+      const string &name = -1 == j ? nbs[i].first : nbs[i].second[j].first;
+      pair<NameIds::iterator,bool> p = name_ids.insert( make_pair( name , names.size() ) );
+      if( p.second ) {
+        names.push_back( &p.first->first );
       }
-      output_stream << "      " << (nbs[i].second)[j].first;
-      pad_spaces( (nbs[i].second)[j].first.length() , max_target_len ,
-                  true , output_stream );
-      output_stream << setw( 6 ) << setprecision( 4 )
-                    << setiosflags( ios::showpoint )
-                    << (nbs[i].second)[j].second << endl;
+      name_nums.push_back( p.first->second );
+    }
+  }
+
+  block.clear();
+  pack_value( chunk_num , block );
+  pack_value( static_cast<unsigned int>( nbs.size() ) , block );
+  pack_value( static_cast<unsigned int>( names.size() ) , block );
+  BOOST_FOREACH( const string *name , names ) {
+    pack_string( *name , block );
+  }
+  vector<unsigned int>::const_iterator nn = name_nums.begin();
+  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    const vector<pair<string,double> > &probe_nbs = nbs[i].second;
+    pack_value( *nn++ , block );
+    pack_value( static_cast<unsigned int>( probe_nbs.size() ) , block );
+    for( unsigned int j = 0 , js = probe_nbs.size() ; j < js ; ++j ) {
+      pack_value( *nn++ , block );
+    }
+    for( unsigned int j = 0 , js = probe_nbs.size() ; j < js ; ++j ) {
+      pack_value( probe_nbs[j].second , block );
     }
-    output_stream << endl;
   }
 
 }
 
 // ****************************************************************************
-void output_neighbours( unsigned int min_count , const string &output_format ,
-                        ostream &output_stream ,
-                        vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+void unpack_nnlists_results( const vector<char> &block , int &chunk_num ,
+                             vector<pair<string,vector<pair<string,double> > > > &nbs ) {
 
-  if( min_count ) {
-    if( string( "SATAN" ) == output_format ) {
-      output_neighbours_satan( min_count , output_stream , nbs );
-    } else {
-      output_neighbours_nnlists( min_count , output_stream , nbs );
+  size_t pos = 0;
+  chunk_num = unpack_value<int>( block , pos );
+  nbs.resize( unpack_value<unsigned int>( block , pos ) );
+  vector<string> names( unpack_value<unsigned int>( block , pos ) );
+  for( unsigned int i = 0 , is = names.size() ; i < is ; ++i ) {
+    names[i] = unpack_string( block , pos );
+  }
+  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    nbs[i].first = names[unpack_value<unsigned int>( block , pos )];
+    unsigned int num_nbs = unpack_value<unsigned int>( block , pos );
+    vector<pair<string,double> > &probe_nbs = nbs[i].second;
+    probe_nbs.resize( num_nbs );
+    for( unsigned int j = 0 ; j < num_nbs ; ++j ) {
+      probe_nbs[j].first = names[unpack_value<unsigned int>( block , pos )];
     }
-  } else {
-    if( string( "SATAN" ) == output_format ) {
-      output_neighbours_satan( output_stream , nbs );
-    } else {
-      output_neighbours_nnlists( output_stream , nbs );
+    for( unsigned int j = 0 ; j < num_nbs ; ++j ) {
+      probe_nbs[j].second = unpack_value<double>( block , pos );
     }
   }
 
 }
 
 // ****************************************************************************
-void output_counts( ostream &output_stream ,
-                    vector<pair<string,vector<unsigned int> > > &counts ) {
+// for counts, it's the chunk number, the number of probes and then each
+// probe's name and 10 counts.
+void pack_counts_results( int chunk_num ,
+                          const vector<pair<string,vector<unsigned int> > > &counts ,
+                          vector<char> &block ) {
+
+  block.clear();
+  pack_value( chunk_num , block );
+  pack_value( static_cast<unsigned int>( counts.size() ) , block );
+  for( unsigned int i = 0 , is = counts.size() ; i < is ; ++i ) {
+    pack_string( counts[i].first , block );
+    for( int j = 0 ; j < 10 ; ++j ) {
+      pack_value( counts[i].second[j] , block );
+    }
+  }
 
-  // snailflush pads the nnlists with spaces so all records are the same length.
-  // Do the same here for consistency, but bearing in mind that it might
-  // not be completely kosher as the probes are being done in batches.
-  unsigned int max_name_len = max_count_name_len( counts );
+}
+
+// ****************************************************************************
+void unpack_counts_results( const vector<char> &block , int &chunk_num ,
+                            vector<pair<string,vector<unsigned int> > > &counts ) {
 
-  for( int i = 0 , is = counts.size() ; i < is ; ++i ) {
-    output_stream << counts[i].first;
-    pad_spaces( counts[i].first.length() , max_name_len + 3 ,
-                false , output_stream );
-    int sum_count = 0;
+  size_t pos = 0;
+  chunk_num = unpack_value<int>( block , pos );
+  counts.resize( unpack_value<unsigned int>( block , pos ) );
+  for( unsigned int i = 0 , is = counts.size() ; i < is ; ++i ) {
+    counts[i].first = unpack_string( block , pos );
+    counts[i].second.resize( 10 );
     for( int j = 0 ; j < 10 ; ++j ) {
-      sum_count += counts[i].second[j];
-      output_stream << setw( 6 ) << sum_count << "  ";
+      counts[i].second[j] = unpack_value<unsigned int>( block , pos );
     }
-    output_stream << endl;
   }
 
 }
 
 // ****************************************************************************
-void dump_fps( vector<FingerprintBase *> &fps ) {
+// With --compress-results, the block is compressed with zlib before it's
+// sent, and goes with its uncompressed size.  The names and distances
+// compress well, so it's worth it when the network is slower than zlib.
+void compress_block( vector<char> &block ) {
+
+  uLongf comp_size = compressBound( block.size() );
+  vector<char> comp_block( sizeof( unsigned long long ) + comp_size );
+  unsigned long long raw_size = block.size();
+  memcpy( &comp_block[0] , &raw_size , sizeof( raw_size ) );
+  if( Z_OK != compress2( reinterpret_cast<Bytef *>( &comp_block[sizeof( raw_size )] ) ,
+                         &comp_size ,
+                         reinterpret_cast<const Bytef *>( block.empty() ? 0 : &block[0] ) ,
+                         block.size() , 1 ) ) {
+    cerr << "Error : failed to compress results for sending to master." << endl;
+    exit( 1 );
+  }
+  comp_block.resize( sizeof( raw_size ) + comp_size );
+  block.swap( comp_block );
 
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    delete fps[i];
+}
+
+// ****************************************************************************
+void uncompress_block( vector<char> &block ) {
+
+  unsigned long long raw_size;
+  memcpy( &raw_size , &block[0] , sizeof( raw_size ) );
+  vector<char> raw_block( raw_size );
+  uLongf uncomp_size = raw_size;
+  if( Z_OK != uncompress( reinterpret_cast<Bytef *>( raw_block.empty() ? 0 : &raw_block[0] ) ,
+                          &uncomp_size ,
+                          reinterpret_cast<const Bytef *>( &block[sizeof( raw_size )] ) ,
+                          block.size() - sizeof( raw_size ) ) ||
+      uncomp_size != raw_size ) {
+    cerr << "Error : failed to uncompress results from slave." << endl;
+    MPI_Finalize();
+    exit( 1 );
   }
-  fps.clear();
+  block.swap( raw_block );
 
 }
 
 // ****************************************************************************
-void open_fp_file( const string &filename ,
-                   DAC_FINGERPRINTS::FP_FILE_FORMAT input_format ,
-                   bool &byteswapping  , gzFile &pfile) {
+void send_results_to_master( const SatanSettings &ss , int chunk_num ,
+                             vector<pair<string,vector<pair<string,double> > > > &nbs ) {
 
-  byteswapping = false;
+  vector<char> block;
+  pack_nnlists_results( chunk_num , nbs , block );
+  if( ss.compress_results() ) {
+    compress_block( block );
+  }
+  DACLIB::send_block( block , 0 );
+
+}
+
+// ****************************************************************************
+void send_results_to_master( const SatanSettings &ss , int chunk_num ,
+                             vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  vector<char> block;
+  pack_counts_results( chunk_num , counts , block );
+  if( ss.compress_results() ) {
+    compress_block( block );
+  }
+  DACLIB::send_block( block , 0 );
+
+}
+
+// ****************************************************************************
+// wait for the next slave to say it's done, returning its rank
+int wait_for_slave() {
+
+  MPI_Status status;
+  MPI_Probe( MPI_ANY_SOURCE , 0 , MPI_COMM_WORLD , &status );
+
+  string msg;
+  DACLIB::mpi_rec_string( status.MPI_SOURCE , msg );
+  if( string( "Slave_Finished" ) != msg ) {
+    cerr << "Error, expected message Slave_Finished from slave, but got "
+         << msg << ". Can't go on." << endl;
+    MPI_Finalize();
+    exit( 1 );
+  }
+  return status.MPI_SOURCE;
+
+}
+
+// ****************************************************************************
+void wait_till_all_slaves_done( bool warm_feeling , int world_size ) {
+
+  int slaves_running = world_size - 1;
+  while( slaves_running > 0 ) {
+    int slave = wait_for_slave();
+    --slaves_running;
+    if( warm_feeling ) {
+      cout << "Slave " << slave << " is finished.  " << slaves_running
+           << " still running." << endl;
+    }
+  }
+
+}
+
+// ****************************************************************************
+void receive_slave_counts_results( const SatanSettings &ss , int slave ,
+                                   int &chunk_num ,
+                                   vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  DACLIB::mpi_send_string( string( "Send_Results" ) , slave );
+
+  vector<char> block;
+  DACLIB::receive_block( slave , block );
+  if( ss.compress_results() ) {
+    uncompress_block( block );
+  }
+  unpack_counts_results( block , chunk_num , counts );
+
+}
+
+// ****************************************************************************
+void receive_slave_nnlists_results( const SatanSettings &ss , int slave ,
+                                    int &chunk_num ,
+                                    vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+
+  DACLIB::mpi_send_string( string( "Send_Results" ) , slave );
+
+  vector<char> block;
+  DACLIB::receive_block( slave , block );
+  if( ss.compress_results() ) {
+    uncompress_block( block );
+  }
+  unpack_nnlists_results( block , chunk_num , nbs );
+
+}
+
+// ****************************************************************************
+// The slaves finish their chunks in any order, but the output must be in
+// probe order, so results that come in early are held until the chunks
+// before them are written.
+typedef map<int,vector<pair<string,vector<pair<string,double> > > > > NbsChunks;
+typedef map<int,vector<pair<string,vector<unsigned int> > > > CountsChunks;
+
+void receive_slave_results( const SatanSettings &ss , int slave ,
+                            int &next_chunk_to_write ,
+                            NbsChunks &nbs_chunks , CountsChunks &counts_chunks ,
+                            SatanOutput &output ) {
+
+  int chunk_num;
+  if( string( "COUNTS" ) == ss.output_format() ) {
+    vector<pair<string,vector<unsigned int> > > counts;
+    receive_slave_counts_results( ss , slave , chunk_num , counts );
+    counts_chunks[chunk_num].swap( counts );
+    CountsChunks::iterator p;
+    while( counts_chunks.end() != ( p = counts_chunks.find( next_chunk_to_write ) ) ) {
+      output.write_counts( p->second );
+      counts_chunks.erase( p );
+      ++next_chunk_to_write;
+    }
+  } else {
+    vector<pair<string,vector<pair<string,double> > > > nbs;
+    receive_slave_nnlists_results( ss , slave , chunk_num , nbs );
+    nbs_chunks[chunk_num].swap( nbs );
+    NbsChunks::iterator p;
+    while( nbs_chunks.end() != ( p = nbs_chunks.find( next_chunk_to_write ) ) ) {
+      output.write_neighbours( p->second );
+      nbs_chunks.erase( p );
+      ++next_chunk_to_write;
+    }
+  }
+
+}
+
+// ****************************************************************************
+// The master reads the probes as it hands the chunks out, so they go to the
+// slave packed with the search details, and the slave doesn't have to read
+// the probe file up to its chunk.
+void send_search_details( SatanSettings &ss , int chunk_num ,
+                          const vector<FingerprintBase *> &probe_fps ,
+                          int slave ) {
+
+  DACLIB::mpi_send_string( string( "Search_Details" ) , slave );
+
+  ss.send_contents_via_mpi( slave );
+
+  // send the chunk number, so the results can be written in order
+  MPI_Send( &chunk_num , 1 , MPI_INT , slave , 0 , MPI_COMM_WORLD );
+
+  vector<char> fp_block;
+  pack_fps( probe_fps , fp_block );
+  DACLIB::send_block( fp_block , slave );
+
+}
+
+// ****************************************************************************
+void receive_search_details( SatanSettings &ss , int &chunk_num ,
+                             vector<FingerprintBase *> &probe_fps ) {
+
+  ss.receive_contents_via_mpi();
+  if( TVERSKY == ss.similarity_calc() ) {
+    FingerprintBase::set_tversky_alpha( ss.tversky_alpha() );
+    HashedFingerprint::set_similarity_calc( ss.similarity_calc() );
+    NotHashedFingerprint::set_similarity_calc( ss.similarity_calc() );
+  }
+
+  MPI_Recv( &chunk_num , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+
+  vector<char> fp_block;
+  DACLIB::receive_block( 0 , fp_block );
+  unpack_fps( ss.input_format() , fp_block , probe_fps );
+
+}
+
+// ****************************************************************************
+void tell_slaves_finished( int world_size ) {
+
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Finished" ) , i );
+  }
+
+}
+
+// ****************************************************************************
+void send_cwd_to_slaves( int world_size ) {
+
+  string cwd = DACLIB::get_cwd();
+  if( cwd.length() ) {
+    // process 0 is the master
+    for( int i = 1 ; i < world_size ; ++i ) {
+      DACLIB::mpi_send_string( string( "New_CWD" ) , i );
+      DACLIB::mpi_send_string( cwd , i );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void receive_new_cwd() {
+
+  string new_cwd;
+  DACLIB::mpi_rec_string( 0 , new_cwd );
+  if(chdir( new_cwd.c_str() ) < 0){
+    cerr << "ERROR : couldn't change to directory " << new_cwd << endl;
+    exit(1);
+  }
+
+}
+
+// ****************************************************************************
+// The probes are done in chunks, handed out to the slaves as they become
+// free, so a slow slave or a dense chunk doesn't hold the others up.  By
+// default there are CHUNKS_PER_SLAVE chunks for each slave; each chunk is
+// another pass through the target file, so not too many.  The master reads
+// the probe file once, a chunk at a time as they're handed out, and sends
+// the probes with the chunk.  A chunk can only be handed out if it's less
+// than MAX_CHUNKS_AHEAD_PER_SLAVE chunks per slave after the first one not
+// yet written, so the results that can't be written yet because an earlier
+// chunk is slow don't pile up at the master.
+static const unsigned int CHUNKS_PER_SLAVE = 4;
+static const int MAX_CHUNKS_AHEAD_PER_SLAVE = 2;
+
+void parallel_run( SatanSettings &ss , int world_size ) {
+
+  // open the output right away, in case we can't. It's best to find
+  // out before we've done a potentially long job.
+  SatanOutput output( ss );
+
+  unsigned int num_probe_fps = 0;
   try {
-    open_fp_file_for_reading( filename , input_format ,
-                              byteswapping , pfile );
+    num_probe_fps = count_fps_in_file( ss.probe_file() , ss.input_format() ,
+                                       ss.bitstring_separator() );
   } catch( DACLIB::FileReadOpenError &e ) {
     cerr << e.what() << endl;
     cout << e.what() << endl;
+    MPI_Finalize();
     exit( 1 );
   } catch( FingerprintFileError &e ) {
     cerr << e.what() << endl;
     cout << e.what() << endl;
+    MPI_Finalize();
     exit( 1 );
   }
 
+  if( num_probe_fps ) {
+    unsigned int num_slave_chunks = CHUNKS_PER_SLAVE * ( world_size - 1 );
+    unsigned int chunk_size = num_probe_fps / num_slave_chunks;
+    while( chunk_size * num_slave_chunks < num_probe_fps ) {
+      ++chunk_size;
+    }
+    if( ss.probe_chunk_size() > 0 ) {
+      chunk_size = ss.probe_chunk_size();
+    }
+    int num_chunks = ( num_probe_fps + chunk_size - 1 ) / chunk_size;
+    int max_chunks_ahead = MAX_CHUNKS_AHEAD_PER_SLAVE * ( world_size - 1 );
+    cout << "Probes done in " << num_chunks << " chunks of " << chunk_size
+         << " probe fps" << endl;
+
+    send_cwd_to_slaves( world_size );
+    gzFile pfile;
+    bool probe_byteswapping;
+    open_fp_file( ss.probe_file() , ss.input_format() , probe_byteswapping , pfile );
+    vector<int> idle_slaves;
+    for( int i = world_size - 1 ; i > 0 ; --i ) {
+      idle_slaves.push_back( i );
+    }
+    // get the results and write them to file as soon as they can be.
+    // This way, we don't ever have to hold the whole, potentially enormous,
+    // neighbour list in memory
+    int next_chunk = 0 , next_chunk_to_write = 0 , slaves_running = 0;
+    NbsChunks nbs_chunks;
+    CountsChunks counts_chunks;
+    while( 1 ) {
+      // send_search_details also fires off the jobs on the slaves
+      while( !idle_slaves.empty() && next_chunk < num_chunks &&
+             next_chunk - next_chunk_to_write < max_chunks_ahead ) {
+        vector<FingerprintBase *> probe_fps;
+        read_fps_from_file( pfile , probe_byteswapping , ss.input_format() ,
+                            ss.bitstring_separator() , 0 , chunk_size , probe_fps );
+        if( probe_fps.empty() ) {
+          // the file's shorter than when it was counted
+          num_chunks = next_chunk;
+          break;
+        }
+        send_search_details( ss , next_chunk++ , probe_fps , idle_slaves.back() );
+        dump_fps( probe_fps );
+        idle_slaves.pop_back();
+        ++slaves_running;
+      }
+      if( !slaves_running ) {
+        break;
+      }
+      int slave = wait_for_slave();
+      --slaves_running;
+      receive_slave_results( ss , slave , next_chunk_to_write , nbs_chunks ,
+                             counts_chunks , output );
+      idle_slaves.push_back( slave );
+      if( ss.warm_feeling() ) {
+        cout << "Slave " << slave << " finished a chunk.  " << next_chunk_to_write
+             << " of " << num_chunks << " chunks written, "
+             << nbs_chunks.size() + counts_chunks.size() << " waiting." << endl;
+      }
+    }
+    close_fp_file_for_reading( pfile );
+  }
+
+  tell_slaves_finished( world_size );
+
+}
+
+// ****************************************************************************
+// The target-sharded parallel run.  The master reads the probes and
+// broadcasts them to all the slaves, then reads the target file once, in
+// blocks, dealing the blocks out to the slaves in turn.  So each slave
+// searches all the probes against its share of the targets, and the target
+// file is only read once however many slaves there are.  The slaves tag the
+// neighbours with the targets' sequence numbers in the file, so the master
+// can merge them, a chunk of probes at a time, into what the serial run
+// would have given.
+static const unsigned int SHARD_RESULTS_CHUNK_SIZE = 10000;
+static const unsigned int NO_MORE_TARGET_BLOCKS = numeric_limits<unsigned int>::max();
+
+// ****************************************************************************
+// the probes are broadcast to all the slaves at once. MPI counts are ints,
+// so a big block goes in pieces.  Called by master and slaves alike.
+static const unsigned long long SEND_PIECE = 1 << 26;
+
+void broadcast_fp_block( vector<char> &fp_block ) {
+
+  unsigned long long block_size = fp_block.size();
+  MPI_Bcast( &block_size , 1 , MPI_UNSIGNED_LONG_LONG , 0 , MPI_COMM_WORLD );
+  fp_block.resize( block_size );
+  for( unsigned long long i = 0 ; i < block_size ; i += SEND_PIECE ) {
+    int piece = min( SEND_PIECE , block_size - i );
+    MPI_Bcast( &fp_block[i] , piece , MPI_CHAR , 0 , MPI_COMM_WORLD );
+  }
+
+}
+
+// ****************************************************************************
+// probe i against a block of targets, the first of which is target number
+// first_target in the file, keeping the target numbers of the neighbours.
+void probe_against_shard_targets( const vector<FingerprintBase *> &target_fps ,
+                                  unsigned int first_target ,
+                                  const vector<FingerprintBase *> &probe_fps ,
+                                  double threshold , unsigned int min_count ,
+                                  unsigned int i ,
+                                  vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                                  vector<vector<unsigned int> > &nb_nums ) {
+
+  vector<pair<string,double> > &probe_nbs = nbs[i].second;
+  for( int j = 0 , js = target_fps.size() ; j < js ; ++j ) {
+    if( min_count && probe_nbs.size() >= min_count ) {
+      break;
+    }
+    double dist = target_fps[j]->calc_distance( *(probe_fps[i] ) , threshold );
+    if( dist <= threshold ) {
+      probe_nbs.push_back( make_pair( target_fps[j]->get_name() , dist ) );
+      nb_nums[i].push_back( first_target + j );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// read the target file in blocks and deal them out to the slaves in turn,
+// each with its block number.
+void deal_target_blocks( const SatanSettings &ss , int world_size ) {
+
+  gzFile tfile;
+  bool target_byteswapping;
+  open_fp_file( ss.target_file() , ss.input_format() , target_byteswapping , tfile );
+
+  unsigned int block_num = 0;
+  vector<FingerprintBase *> target_fps;
+  vector<char> fp_block;
+  while( 1 ) {
+    read_fps_from_file( tfile , target_byteswapping , ss.input_format() ,
+                        ss.bitstring_separator() , 0 , ss.target_block_size() ,
+                        target_fps );
+    if( target_fps.empty() ) {
+      break;
+    }
+    int slave = 1 + block_num % ( world_size - 1 );
+    fp_block.clear();
+    pack_fps( target_fps , fp_block );
+    MPI_Send( &block_num , 1 , MPI_UNSIGNED , slave , 0 , MPI_COMM_WORLD );
+    DACLIB::send_block( fp_block , slave );
+    dump_fps( target_fps );
+    ++block_num;
+  }
+  close_fp_file_for_reading( tfile );
+
+  for( int i = 1 ; i < world_size ; ++i ) {
+    MPI_Send( const_cast<unsigned int *>( &NO_MORE_TARGET_BLOCKS ) , 1 , MPI_UNSIGNED ,
+              i , 0 , MPI_COMM_WORLD );
+  }
+  if( ss.warm_feeling() ) {
+    cout << "Dealt " << block_num << " blocks of targets to the slaves." << endl;
+  }
+
 }
 
 // ****************************************************************************
-void target_against_probes( const FingerprintBase *target_fp ,
-                            const vector<FingerprintBase *> &probe_fps ,
-                            double threshold , unsigned int min_count ,
-                            vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+// the slave's side of deal_target_blocks.  The probes have already been
+// received, and nbs and counts set up for them.
+void search_target_shard( const SatanSettings &ss ,
+                          const vector<FingerprintBase *> &probe_fps ,
+                          vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                          vector<vector<unsigned int> > &nb_nums ,
+                          vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  bool counts_output = string( "COUNTS" ) == ss.output_format();
+  CountsSearch counts_search( ss , probe_fps );
+  vector<unsigned int> target_name_ids;
+  vector<FingerprintBase *> target_fps;
+  vector<char> fp_block;
+  while( 1 ) {
+    unsigned int block_num;
+    MPI_Recv( &block_num , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+    if( NO_MORE_TARGET_BLOCKS == block_num ) {
+      break;
+    }
+    DACLIB::receive_block( 0 , fp_block );
+    unpack_fps( ss.input_format() , fp_block , target_fps );
+    if( counts_output ) {
+      make_target_name_ids( target_fps , counts_search.name_ids_ ,
+                            target_name_ids );
+      DACLIB::parallel_loop( probe_fps.size() , ss.num_threads() ,
+                             boost::bind( &probe_counts_against_targets ,
+                                          boost::cref( counts_search ) ,
+                                          boost::cref( target_fps ) ,
+                                          boost::cref( target_name_ids ) ,
+                                          boost::cref( probe_fps ) , _1 ,
+                                          boost::ref( counts ) ) , 16 );
+    } else {
+      DACLIB::parallel_loop( probe_fps.size() , ss.num_threads() ,
+                             boost::bind( &probe_against_shard_targets ,
+                                          boost::cref( target_fps ) ,
+                                          block_num * ss.target_block_size() ,
+                                          boost::cref( probe_fps ) ,
+                                          ss.threshold() ,
+                                          static_cast<unsigned int>( ss.min_count() ) ,
+                                          _1 , boost::ref( nbs ) ,
+                                          boost::ref( nb_nums ) ) , 16 );
+    }
+    dump_fps( target_fps );
+  }
+
+}
 
-  for( int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
-    if( !min_count || nbs[i].second.size() < min_count ) {
-      double dist = target_fp->calc_distance( *(probe_fps[i] ) , threshold );
-      if( dist <= threshold ) {
-        nbs[i].second.push_back( make_pair( target_fp->get_name() , dist ) );
+// ****************************************************************************
+// the slave's results for probes first_probe to first_probe + num_probes - 1,
+// packed up and sent to the master.
+void send_shard_results( const SatanSettings &ss ,
+                         const vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                         const vector<vector<unsigned int> > &nb_nums ,
+                         const vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  unsigned int probe_range[2];
+  MPI_Recv( probe_range , 2 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  vector<char> block;
+  for( unsigned int i = probe_range[0] ; i < probe_range[0] + probe_range[1] ; ++i ) {
+    if( string( "COUNTS" ) == ss.output_format() ) {
+      for( int j = 0 ; j < 10 ; ++j ) {
+        pack_value( counts[i].second[j] , block );
+      }
+    } else {
+      pack_value( static_cast<unsigned int>( nbs[i].second.size() ) , block );
+      for( unsigned int j = 0 , js = nbs[i].second.size() ; j < js ; ++j ) {
+        pack_value( nb_nums[i][j] , block );
+        pack_value( nbs[i].second[j].second , block );
+        pack_string( nbs[i].second[j].first , block );
       }
     }
   }
+  DACLIB::send_block( block , 0 );
 
 }
 
 // ****************************************************************************
-// the counts version.  If dist is 0.44, then counts[4] will be incremented
-void target_against_probes( const FingerprintBase *target_fp ,
+// get the slaves' results for a chunk of probes and merge them.  Each
+// probe's neighbours are put back in target file order, so that with a
+// min_count the same ones are kept as in a serial run, and then sorted for
+// output in the usual way.
+void receive_shard_results( const SatanSettings &ss , int world_size ,
                             const vector<FingerprintBase *> &probe_fps ,
-                            vector<pair<string,vector<unsigned int> > > &counts ) {
+                            SatanOutput &output ) {
+
+  bool counts_output = string( "COUNTS" ) == ss.output_format();
+  unsigned int min_count = ss.min_count();
+  for( unsigned int first_probe = 0 ; first_probe < probe_fps.size() ;
+       first_probe += SHARD_RESULTS_CHUNK_SIZE ) {
+    unsigned int probe_range[2] = { first_probe ,
+                                    min( SHARD_RESULTS_CHUNK_SIZE ,
+                                         static_cast<unsigned int>( probe_fps.size() ) - first_probe ) };
+    vector<pair<string,vector<unsigned int> > > counts;
+    vector<vector<pair<unsigned int,pair<string,double> > > > num_nbs( probe_range[1] );
+    if( counts_output ) {
+      for( unsigned int i = 0 ; i < probe_range[1] ; ++i ) {
+        counts.push_back( make_pair( probe_fps[first_probe + i]->get_name() ,
+                                     vector<unsigned int>( 10 , 0 ) ) );
+      }
+    }
+
+    for( int slave = 1 ; slave < world_size ; ++slave ) {
+      DACLIB::mpi_send_string( string( "Send_Shard_Results" ) , slave );
+      MPI_Send( probe_range , 2 , MPI_UNSIGNED , slave , 0 , MPI_COMM_WORLD );
+      vector<char> block;
+      DACLIB::receive_block( slave , block );
+      size_t pos = 0;
+      for( unsigned int i = 0 ; i < probe_range[1] ; ++i ) {
+        if( counts_output ) {
+          for( int j = 0 ; j < 10 ; ++j ) {
+            counts[i].second[j] += unpack_value<unsigned int>( block , pos );
+          }
+        } else {
+          unsigned int num_probe_nbs = unpack_value<unsigned int>( block , pos );
+          for( unsigned int j = 0 ; j < num_probe_nbs ; ++j ) {
+            unsigned int target_num = unpack_value<unsigned int>( block , pos );
+            double dist = unpack_value<double>( block , pos );
+            string target_name = unpack_string( block , pos );
+            num_nbs[i].push_back( make_pair( target_num , make_pair( target_name , dist ) ) );
+          }
+        }
+      }
+    }
 
-  for( int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
-    // traditionally, we don't report the compound with itself, even though
-    // the test is going to slow things down badly.
-    if( probe_fps[i]->get_name() != target_fp->get_name() ) {
-      double dist = 10.0 * target_fp->calc_distance( *(probe_fps[i]) );
-      int cbin = int( dist );
-      cbin = 10 == cbin ? 9 : cbin;
-      // bins go to <= dist, so on the border is in the previous bin
-      if( cbin && fabs( double( cbin ) - dist ) < 1.0e-16 ) {
-        --cbin;
+    if( counts_output ) {
+      output.write_counts( counts );
+    } else {
+      vector<pair<string,vector<pair<string,double> > > > nbs( probe_range[1] );
+      for( unsigned int i = 0 ; i < probe_range[1] ; ++i ) {
+        nbs[i].first = probe_fps[first_probe + i]->get_name();
+        sort( num_nbs[i].begin() , num_nbs[i].end() ,
+              boost::bind( &pair<unsigned int,pair<string,double> >::first , _1 ) <
+              boost::bind( &pair<unsigned int,pair<string,double> >::first , _2 ) );
+        if( min_count && num_nbs[i].size() > min_count ) {
+          num_nbs[i].resize( min_count );
+        }
+        for( unsigned int j = 0 ; j < num_nbs[i].size() ; ++j ) {
+          nbs[i].second.push_back( num_nbs[i][j].second );
+        }
+        sort( nbs[i].second.begin() , nbs[i].second.end() , SortNbsByDist() );
       }
-      ++(counts[i].second[cbin]);
+      output.write_neighbours( nbs );
     }
   }
 
 }
 
 // ****************************************************************************
-void process_fingerprints( const SatanSettings &ss ,
-                           unsigned int num_probe_fps , int chunk_num ,
-                           vector<pair<string,vector<pair<string,double> > > > &nbs ,
-                           vector<pair<string,vector<unsigned int> > > &counts ) {
+void sharded_parallel_run( SatanSettings &ss , int world_size ) {
 
-  gzFile pfile , tfile;
-  bool target_byteswapping , probe_byteswapping;
+  // open the output right away, in case we can't. It's best to find
+  // out before we've done a potentially long job.
+  SatanOutput output( ss );
 
-  // read next lot of probe fps
+  gzFile pfile;
+  bool probe_byteswapping;
   open_fp_file( ss.probe_file() , ss.input_format() , probe_byteswapping , pfile );
   vector<FingerprintBase *> probe_fps;
-  unsigned int start_probe_fp = num_probe_fps * chunk_num;
   read_fps_from_file( pfile , probe_byteswapping , ss.input_format() ,
-                      ss.bitstring_separator() , start_probe_fp ,
-                      num_probe_fps , probe_fps );
-
-  if( probe_fps.empty() ) {
-    cerr << "Error : premature end of file " << ss.probe_file() << endl;
-    gzclose( pfile );
-    exit( 1 );
-  }
+                      ss.bitstring_separator() , 0 ,
+                      numeric_limits<unsigned int>::max() , probe_fps );
+  close_fp_file_for_reading( pfile );
   if( ss.warm_feeling() ) {
     cout << "Read " << probe_fps.size() << " probes." << endl;
   }
 
+  if( !probe_fps.empty() ) {
+    send_cwd_to_slaves( world_size );
+    for( int i = 1 ; i < world_size ; ++i ) {
+      DACLIB::mpi_send_string( string( "Shard_Search_Details" ) , i );
+      ss.send_contents_via_mpi( i );
+    }
+    vector<char> fp_block;
+    pack_fps( probe_fps , fp_block );
+    broadcast_fp_block( fp_block );
+    vector<char>().swap( fp_block );
+
+    deal_target_blocks( ss , world_size );
+    wait_till_all_slaves_done( ss.warm_feeling() , world_size );
+    receive_shard_results( ss , world_size , probe_fps , output );
+  }
+  dump_fps( probe_fps );
+
+  tell_slaves_finished( world_size );
+
+}
+
+// ****************************************************************************
+// the slave's side of sharded_parallel_run, up to sending the results
+void slave_shard_search( SatanSettings &ss ,
+                         vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                         vector<vector<unsigned int> > &nb_nums ,
+                         vector<pair<string,vector<unsigned int> > > &counts ) {
+
+  ss.receive_contents_via_mpi();
+  if( TVERSKY == ss.similarity_calc() ) {
+    FingerprintBase::set_tversky_alpha( ss.tversky_alpha() );
+    HashedFingerprint::set_similarity_calc( ss.similarity_calc() );
+    NotHashedFingerprint::set_similarity_calc( ss.similarity_calc() );
+  }
+
+  vector<FingerprintBase *> probe_fps;
+  {
+    vector<char> fp_block;
+    broadcast_fp_block( fp_block );
+    unpack_fps( ss.input_format() , fp_block , probe_fps );
+  }
+
   if( string( "COUNTS" ) == ss.output_format() ) {
-    counts.reserve( probe_fps.size() );
     BOOST_FOREACH( FingerprintBase *pfp , probe_fps ) {
       counts.push_back( make_pair( pfp->get_name() , vector<unsigned int>( 10 , 0 ) ) );
     }
   } else {
-    nbs.reserve( probe_fps.size() );
     BOOST_FOREACH( FingerprintBase *pfp , probe_fps ) {
       nbs.push_back( make_pair( pfp->get_name() , vector<pair<string,double> >() ) );
     }
+    nb_nums.resize( probe_fps.size() );
   }
 
-  open_fp_file( ss.target_file() , ss.input_format() , target_byteswapping , tfile );
-
-  int num_targets = 0;
-  bool counts_output = string( "COUNTS" ) == ss.output_format() ? true : false;
+  search_target_shard( ss , probe_fps , nbs , nb_nums , counts );
+  dump_fps( probe_fps );
 
-  while( 1 ) {
-    FingerprintBase *target_fp = read_next_fp_from_file( tfile , target_byteswapping ,
-                                                         ss.input_format() ,
-                                                         ss.bitstring_separator() );
-    if( !target_fp ) {
-      break;
-    }
-    ++num_targets;
+}
 
-    if( counts_output ) {
-      target_against_probes( target_fp , probe_fps , counts );
-    } else {
-      target_against_probes( target_fp , probe_fps , ss.threshold() ,
-                             ss.min_count() , nbs );
-    }
-    delete target_fp;
-  }
+// ****************************************************************************
+// With --self, the probe file is searched against itself.  The distance is
+// symmetric, so each pair of fingerprints i < j is only done once, and a hit
+// goes in both their neighbour lists, or the distance in both their COUNTS.
+// Row i of the triangle is fingerprint i against i + 1 onwards, so rows i
+// and n - 1 - i together are n - 1 distances, and the work is shared out
+// between the processes, and then between their threads, as equal ranges
+// of these row pairs.  Each process reads the whole file, and the master
+// holds all the results at the end.
+struct SelfHit {
+
+  SelfHit( unsigned int i , unsigned int j , double dist ) :
+    i_( i ) , j_( j ) , dist_( dist ) {}
+
+  unsigned int i_ , j_; // i_ <= j_, equal for a fingerprint with itself
+  double dist_;
 
-  gzclose( pfile );
-  gzclose( tfile );
+};
 
-  // we're done with probes
-  dump_fps( probe_fps );
+struct SelfResults {
 
-  // sort the neighbour lists ready for output
-  for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    sort( nbs[i].second.begin() , nbs[i].second.end() , SortNbsByDist() );
-  }
+  vector<SelfHit> hits_;
+  vector<unsigned int> counts_; // 10 for each fingerprint, for COUNTS
 
-}
+};
 
 // ****************************************************************************
-void serial_run( const SatanSettings &ss ) {
-
-  // open the output stream right away, in case we can't. It's best to find
-  // out before we've done a potentially long job.
-  ofstream output_stream( ss.output_file().c_str() ) ;
-  if( !output_stream.good() ) {
-    cerr << "Couldn't open " << ss.output_file() << " for writing." << endl;
-    exit( 1 );
-  }
+void read_self_fps( const SatanSettings &ss , vector<FingerprintBase *> &fps ) {
 
-    vector<pair<string,vector<pair<string,double> > > > nbs;
-    vector<pair<string,vector<unsigned int> > > counts;
-    process_fingerprints( ss , numeric_limits<unsigned int>::max() , 0 ,
-                          nbs , counts );
-    if( !nbs.empty() ) {
-      output_neighbours( ss.min_count() , ss.output_format() , output_stream , nbs );
-    }
-    if( !counts.empty( ) ){
-      output_counts( output_stream , counts );
-    }
+  gzFile pfile;
+  bool probe_byteswapping;
+  open_fp_file( ss.probe_file() , ss.input_format() , probe_byteswapping , pfile );
+  read_fps_from_file( pfile , probe_byteswapping , ss.input_format() ,
+                      ss.bitstring_separator() , 0 ,
+                      numeric_limits<unsigned int>::max() , fps );
+  close_fp_file_for_reading( pfile );
 
 }
 
 // ****************************************************************************
-void tell_master_slave_has_done_nnlists() {
+// the row pairs first to last - 1 are share number share of num_shares
+void self_row_pairs( unsigned int num_fps , unsigned int share ,
+                     unsigned int num_shares , unsigned int &first ,
+                     unsigned int &last ) {
 
-  // tell the master we're finished.  It'll then pick the results up in
-  // the correct order.
-  DACLIB::mpi_send_string( string( "Slave_Finished" ) , 0 );
+  unsigned long long num_row_pairs = ( num_fps + 1ULL ) / 2;
+  first = share * num_row_pairs / num_shares;
+  last = ( share + 1 ) * num_row_pairs / num_shares;
 
 }
 
 // ****************************************************************************
-void send_results_to_master( int chunk_num ,
-                             vector<pair<string,vector<pair<string,double> > > > &nbs ) {
-
-  MPI_Send( &chunk_num , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD );
-  unsigned int num_to_send = nbs.size();
-  MPI_Send( &num_to_send , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
+// row i of the triangle, including fingerprint i with itself, which the
+// ordinary search finds as a neighbour.  COUNTS leaves it out by name.
+void self_search_row( const SatanSettings &ss ,
+                      const vector<FingerprintBase *> &fps ,
+                      const CountsSearch &counts_search ,
+                      bool counts_output , unsigned int i ,
+                      SelfResults &results ) {
+
+  if( counts_output ) {
+    counts_search.hist_.add_self_distances( fps , &counts_search.probe_name_ids_[0] ,
+                                            i , &results.counts_[0] );
+    return;
+  }
 
-  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
-    DACLIB::mpi_send_string( nbs[i].first , 0 );
-    unsigned int j = (nbs[i].second).size();
-    MPI_Send( &j , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
-    for( int k = 0 , ks = (nbs[i].second).size() ; k < ks ; ++k ) {
-      DACLIB::mpi_send_string( (nbs[i].second)[k].first , 0 );
-      MPI_Send( &(nbs[i].second)[k].second , 1 , MPI_DOUBLE , 0 , 0 , MPI_COMM_WORLD );
+  double threshold = ss.threshold();
+  for( unsigned int j = i , js = fps.size() ; j < js ; ++j ) {
+    double dist = fps[j]->calc_distance( *fps[i] , threshold );
+    if( dist <= threshold ) {
+      results.hits_.push_back( SelfHit( i , j , dist ) );
     }
   }
 
 }
 
 // ****************************************************************************
-void send_results_to_master( int chunk_num ,
-                             vector<pair<string,vector<unsigned int> > > &counts ) {
-
-  MPI_Send( &chunk_num , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD );
-  unsigned int num_to_send = counts.size();
-  MPI_Send( &num_to_send , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
-
-  for( unsigned int i = 0 , is = counts.size() ; i < is ; ++i ) {
-    DACLIB::mpi_send_string( counts[i].first , 0 );
-    MPI_Send( &counts[i].second[0] , 10 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD );
+// a worker thread's row pairs.  Other threads' rows reach this thread's
+// fingerprints, so each thread has its own results.
+void self_search_rows( const SatanSettings &ss ,
+                       const vector<FingerprintBase *> &fps ,
+                       const CountsSearch &counts_search ,
+                       unsigned int first_row_pair , unsigned int last_row_pair ,
+                       SelfResults &results ) {
+
+  bool counts_output = string( "COUNTS" ) == ss.output_format();
+  if( counts_output ) {
+    results.counts_.assign( fps.size() * 10 , 0 );
+  }
+  unsigned int last_row = fps.size() - 1;
+  for( unsigned int i = first_row_pair ; i < last_row_pair ; ++i ) {
+    self_search_row( ss , fps , counts_search , counts_output , i , results );
+    if( last_row - i != i ) {
+      self_search_row( ss , fps , counts_search , counts_output , last_row - i ,
+                       results );
+    }
   }
 
 }
 
 // ****************************************************************************
-void wait_till_all_slaves_done( bool warm_feeling , int world_size ) {
+void add_self_results( const SelfResults &more_results , SelfResults &results ) {
 
-  int slaves_running = world_size - 1;
-  while( slaves_running > 0 ) {
-    MPI_Status status;
-    MPI_Probe( MPI_ANY_SOURCE , 0 , MPI_COMM_WORLD , &status );
-
-    string msg;
-    DACLIB::mpi_rec_string( status.MPI_SOURCE , msg );
-    if( string( "Slave_Finished" ) != msg ) {
-      cerr << "Error, expected message Slave_Finished from slave, but got "
-           << msg << ". Can't go on." << endl;
-      MPI_Finalize();
-      exit( 1 );
-    }
-    --slaves_running;
-    if( warm_feeling ) {
-      cout << "Slave " << status.MPI_SOURCE << " is finished.  " << slaves_running
-           << " still running." << endl;
+  results.hits_.insert( results.hits_.end() , more_results.hits_.begin() ,
+                        more_results.hits_.end() );
+  if( results.counts_.empty() ) {
+    results.counts_ = more_results.counts_;
+  } else {
+    for( unsigned int k = 0 , ks = more_results.counts_.size() ; k < ks ; ++k ) {
+      results.counts_[k] += more_results.counts_[k];
     }
   }
 
 }
 
 // ****************************************************************************
-void receive_slave_counts_results( int world_size ,
-                                   ostream &output_stream ) {
-
-  vector<pair<string,vector<unsigned int> > > counts;
-  // get the results from the slaves in order, because that's important
-  // to keep the output in probe input order.  The chunks have been sent off
-  // in slave_tids order.
-  for( int i = 1 ; i < world_size ; ++i ) {
-    DACLIB::mpi_send_string( string( "Send_Results" ) , i );
+// share number share of num_shares of the triangle, added to results
+void self_search( const SatanSettings &ss , const vector<FingerprintBase *> &fps ,
+                  unsigned int share , unsigned int num_shares ,
+                  SelfResults &results ) {
+
+  CountsSearch counts_search( ss , fps );
+  unsigned int first_row_pair , last_row_pair;
+  self_row_pairs( fps.size() , share , num_shares , first_row_pair , last_row_pair );
+  unsigned int num_row_pairs = last_row_pair - first_row_pair;
+  unsigned int num_workers = max( 1U , min( static_cast<unsigned int>( ss.num_threads() ) ,
+                                            num_row_pairs ) );
+
+  vector<SelfResults> thread_results( num_workers );
+  boost::thread_group threads;
+  for( unsigned int k = 0 ; k < num_workers ; ++k ) {
+    threads.create_thread( boost::bind( &self_search_rows , boost::cref( ss ) ,
+                                        boost::cref( fps ) ,
+                                        boost::cref( counts_search ) ,
+                                        first_row_pair + k * num_row_pairs / num_workers ,
+                                        first_row_pair + ( k + 1 ) * num_row_pairs / num_workers ,
+                                        boost::ref( thread_results[k] ) ) );
+  }
+  threads.join_all();
 
-    int chunk_num;
-    MPI_Recv( &chunk_num , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    unsigned int num_to_rec;
-    MPI_Recv( &num_to_rec , 1 , MPI_UNSIGNED , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    counts.resize( num_to_rec );
-    for( unsigned int k = 0 ; k < num_to_rec ; ++k ) {
-      DACLIB::mpi_rec_string( i , counts[k].first );
-      counts[k].second = vector<unsigned int>( 10 , 0 );
-      MPI_Recv( &counts[k].second[0] , 10 , MPI_UNSIGNED , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    }
-    output_counts( output_stream , counts );
-    counts.clear();
+  for( unsigned int k = 0 ; k < num_workers ; ++k ) {
+    add_self_results( thread_results[k] , results );
+    vector<SelfHit>().swap( thread_results[k].hits_ );
   }
 
 }
 
 // ****************************************************************************
-void receive_slave_nnlists_results( int world_size , int min_count ,
-                                    const string &output_format ,
-                                    ostream &output_stream ) {
+// Each fingerprint's neighbours are put in file order, as the ordinary
+// search finds them, so that with a min_count the same ones are kept, and
+// then sorted for output in the usual way.
+void output_self_results( const SatanSettings &ss ,
+                          const vector<FingerprintBase *> &fps ,
+                          SelfResults &results , SatanOutput &output ) {
 
-  vector<pair<string,vector<pair<string,double> > > > nbs;
-  // get the results from the slaves in order, because that's important
-  // to keep the output in probe input order.  The chunks have been sent off
-  // in slave_tids order.
-  for( int i = 1 ; i < world_size ; ++i ) {
-    DACLIB::mpi_send_string( string( "Send_Results" ) , i );
-
-    int chunk_num;
-    unsigned int num_to_rec , num_nbs;
-    string target_name;
-    double target_dist;
-    MPI_Recv( &chunk_num , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    MPI_Recv( &num_to_rec , 1 , MPI_UNSIGNED , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-    nbs.resize( num_to_rec );
-    for( unsigned int k = 0 ; k < num_to_rec ; ++k ) {
-      DACLIB::mpi_rec_string( i , nbs[k].first );
-      MPI_Recv( &num_nbs , 1 , MPI_UNSIGNED , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-      nbs[i].second.reserve( num_nbs );
-      for( unsigned int j = 0 ; j < num_nbs ; ++j ) {
-        DACLIB::mpi_rec_string( i , target_name );
-        MPI_Recv( &target_dist , 1 , MPI_DOUBLE , i , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-        nbs[k].second.push_back( make_pair( target_name , target_dist ) );
-      }
+  if( string( "COUNTS" ) == ss.output_format() ) {
+    vector<pair<string,vector<unsigned int> > > counts;
+    counts.reserve( fps.size() );
+    for( unsigned int i = 0 , is = fps.size() ; i < is ; ++i ) {
+      counts.push_back( make_pair( fps[i]->get_name() ,
+                                   vector<unsigned int>( results.counts_.begin() + i * 10 ,
+                                                         results.counts_.begin() + ( i + 1 ) * 10 ) ) );
     }
-    output_neighbours( min_count , output_format , output_stream , nbs );
-    nbs.clear();
+    output.write_counts( counts );
+    return;
   }
 
+  vector<vector<pair<unsigned int,double> > > num_nbs( fps.size() );
+  BOOST_FOREACH( const SelfHit &hit , results.hits_ ) {
+    num_nbs[hit.i_].push_back( make_pair( hit.j_ , hit.dist_ ) );
+    if( hit.i_ != hit.j_ ) {
+      num_nbs[hit.j_].push_back( make_pair( hit.i_ , hit.dist_ ) );
+    }
+  }
+  vector<SelfHit>().swap( results.hits_ );
+
+  unsigned int min_count = ss.min_count();
+  vector<pair<string,vector<pair<string,double> > > > nbs( fps.size() );
+  for( unsigned int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    nbs[i].first = fps[i]->get_name();
+    sort( num_nbs[i].begin() , num_nbs[i].end() );
+    if( min_count && num_nbs[i].size() > min_count ) {
+      num_nbs[i].resize( min_count );
+    }
+    nbs[i].second.reserve( num_nbs[i].size() );
+    for( unsigned int j = 0 , js = num_nbs[i].size() ; j < js ; ++j ) {
+      nbs[i].second.push_back( make_pair( fps[num_nbs[i][j].first]->get_name() ,
+                                          num_nbs[i][j].second ) );
+    }
+    vector<pair<unsigned int,double> >().swap( num_nbs[i] );
+    sort( nbs[i].second.begin() , nbs[i].second.end() , SortNbsByDist() );
+  }
+  output.write_neighbours( nbs );
+
 }
 
 // ****************************************************************************
-void receive_slave_results( bool warm_feeling , int world_size ,
-                            int min_count , const string &output_format ,
-                            ostream &output_stream ) {
+void self_serial_run( const SatanSettings &ss ) {
 
-  // first, wait for all the slaves to report they're done. Doing it this way
-  // will allow us to spot dead slaves early and take appropriate action.
-  wait_till_all_slaves_done( warm_feeling , world_size );
+  // open the output right away, in case we can't. It's best to find
+  // out before we've done a potentially long job.
+  SatanOutput output( ss );
 
-  if( string( "COUNTS" ) == output_format ) {
-    receive_slave_counts_results( world_size , output_stream );
-  } else {
-    receive_slave_nnlists_results( world_size , min_count ,
-                                   output_format , output_stream );
+  vector<FingerprintBase *> fps;
+  read_self_fps( ss , fps );
+  if( fps.empty() ) {
+    cerr << "Error : premature end of file " << ss.probe_file() << endl;
+    exit( 1 );
+  }
+  if( ss.warm_feeling() ) {
+    cout << "Read " << fps.size() << " fingerprints." << endl;
   }
 
+  SelfResults results;
+  self_search( ss , fps , 0 , 1 , results );
+  output_self_results( ss , fps , results , output );
+  dump_fps( fps );
+
 }
 
 // ****************************************************************************
-void send_search_details( SatanSettings &ss , unsigned int num_probe_fps ,
-                          int world_size ) {
-
-  // each slave needs to do something like num_probe_fps / num_procs probe fps
-  // each against all targets
-  unsigned int slave_does = num_probe_fps / ( world_size - 1 );
-  while( slave_does * ( world_size - 1 ) < num_probe_fps ) {
-    ++slave_does;
+// the hits, then the counts
+void pack_self_results( const SelfResults &results , vector<char> &block ) {
+
+  block.clear();
+  pack_value( static_cast<unsigned long long>( results.hits_.size() ) , block );
+  BOOST_FOREACH( const SelfHit &hit , results.hits_ ) {
+    pack_value( hit.i_ , block );
+    pack_value( hit.j_ , block );
+    pack_value( hit.dist_ , block );
   }
-  cout << "Each slave does " << slave_does << " probe fps " << endl;
-
-  for( int i = 1 ; i < world_size ; ++i ) {
-    DACLIB::mpi_send_string( string( "Search_Details" ) , i );
-
-    ss.send_contents_via_mpi( i );
-
-    // send the number of fps each slave must do, and the slave number,
-    // so it knows where to start
-    MPI_Send( &slave_does , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD );
-    MPI_Send( &i , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD );
+  pack_value( static_cast<unsigned int>( results.counts_.size() ) , block );
+  BOOST_FOREACH( unsigned int count , results.counts_ ) {
+    pack_value( count , block );
   }
 
 }
 
 // ****************************************************************************
-void receive_search_details( SatanSettings &ss ,
-                             unsigned int &num_probe_fps_to_do ,
-                             int &chunk_num ) {
-
-  ss.receive_contents_via_mpi();
-  if( TVERSKY == ss.similarity_calc() ) {
-    FingerprintBase::set_tversky_alpha( ss.tversky_alpha() );
-    HashedFingerprint::set_similarity_calc( ss.similarity_calc() );
-    NotHashedFingerprint::set_similarity_calc( ss.similarity_calc() );
+// add the packed results to results
+void unpack_self_results( const vector<char> &block , SelfResults &results ) {
+
+  size_t pos = 0;
+  unsigned long long num_hits = unpack_value<unsigned long long>( block , pos );
+  results.hits_.reserve( results.hits_.size() + num_hits );
+  for( unsigned long long k = 0 ; k < num_hits ; ++k ) {
+    unsigned int i = unpack_value<unsigned int>( block , pos );
+    unsigned int j = unpack_value<unsigned int>( block , pos );
+    double dist = unpack_value<double>( block , pos );
+    results.hits_.push_back( SelfHit( i , j , dist ) );
+  }
+  unsigned int num_counts = unpack_value<unsigned int>( block , pos );
+  results.counts_.resize( num_counts , 0 );
+  for( unsigned int k = 0 ; k < num_counts ; ++k ) {
+    results.counts_[k] += unpack_value<unsigned int>( block , pos );
   }
-
-  MPI_Recv( &num_probe_fps_to_do , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  MPI_Recv( &chunk_num , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  --chunk_num; // chunk_num is based on the MPI rank of the slave, which starts from 1
 
 }
 
 // ****************************************************************************
-void send_cwd_to_slaves( int world_size ) {
+// the master reads the fingerprints for their names while the slaves search
+// their shares of the triangle, and then collects and merges the results.
+void self_parallel_run( SatanSettings &ss , int world_size ) {
 
-  string cwd = DACLIB::get_cwd();
-  if( cwd.length() ) {
-    // process 0 is the master
-    for( int i = 1 ; i < world_size ; ++i ) {
-      DACLIB::mpi_send_string( string( "New_CWD" ) , i );
-      DACLIB::mpi_send_string( cwd , i );
+  // open the output right away, in case we can't. It's best to find
+  // out before we've done a potentially long job.
+  SatanOutput output( ss );
+
+  send_cwd_to_slaves( world_size );
+  for( int i = 1 ; i < world_size ; ++i ) {
+    DACLIB::mpi_send_string( string( "Self_Search_Details" ) , i );
+    ss.send_contents_via_mpi( i );
+  }
+
+  vector<FingerprintBase *> fps;
+  read_self_fps( ss , fps );
+  if( ss.warm_feeling() ) {
+    cout << "Read " << fps.size() << " fingerprints." << endl;
+  }
+  wait_till_all_slaves_done( ss.warm_feeling() , world_size );
+
+  SelfResults results;
+  vector<char> block;
+  for( int slave = 1 ; slave < world_size ; ++slave ) {
+    DACLIB::mpi_send_string( string( "Send_Self_Results" ) , slave );
+    DACLIB::receive_block( slave , block );
+    if( ss.compress_results() ) {
+      uncompress_block( block );
     }
+    unpack_self_results( block , results );
   }
+  vector<char>().swap( block );
+  if( !fps.empty() ) {
+    output_self_results( ss , fps , results , output );
+  }
+  dump_fps( fps );
+
+  tell_slaves_finished( world_size );
 
 }
 
 // ****************************************************************************
-void receive_new_cwd() {
-
-  string new_cwd;
-  DACLIB::mpi_rec_string( 0 , new_cwd );
-  if(chdir( new_cwd.c_str() ) < 0){
-    cerr << "ERROR : couldn't change to directory " << new_cwd << endl;
-    exit(1);
-  }
+// the slave's side of self_parallel_run, up to sending the results.  Slave
+// number r does share r - 1 of the triangle.
+void slave_self_search( SatanSettings &ss , SelfResults &results ) {
 
-}
+  ss.receive_contents_via_mpi();
 
-// ****************************************************************************
-void parallel_run( SatanSettings &ss , int world_size ) {
+  int world_rank , world_size;
+  MPI_Comm_rank( MPI_COMM_WORLD , &world_rank );
+  MPI_Comm_size( MPI_COMM_WORLD , &world_size );
 
-  // open the output stream right away, in case we can't. It's best to find
-  // out before we've done a potentially long job.
-  ofstream output_stream( ss.output_file().c_str() ) ;
-  if( !output_stream.good() ) {
-    cerr << "Couldn't open " << ss.output_file() << " for writing." << endl;
-    exit( 1 );
-  }
+  vector<FingerprintBase *> fps;
+  read_self_fps( ss , fps );
+  self_search( ss , fps , world_rank - 1 , world_size - 1 , results );
+  dump_fps( fps );
 
-  unsigned int num_probe_fps = 0;
-  try {
-    num_probe_fps = count_fps_in_file( ss.probe_file() , ss.input_format() ,
-                                       ss.bitstring_separator() );
-  } catch( DACLIB::FileReadOpenError &e ) {
-    cerr << e.what() << endl;
-    cout << e.what() << endl;
-    MPI_Finalize();
-    exit( 1 );
-  } catch( FingerprintFileError &e ) {
-    cerr << e.what() << endl;
-    cout << e.what() << endl;
-    MPI_Finalize();
-    exit( 1 );
-  }
+}
 
-  if( num_probe_fps ) {
-    send_cwd_to_slaves( world_size );
-    // send_search_details also fires off the jobs on the slaves
-    send_search_details( ss , num_probe_fps , world_size );
-    // get the results and write directly to file. This way, we don't ever
-    // have to hold the whole, potentially enormous, neighbour list in
-    // memory
-    receive_slave_results( ss.warm_feeling() , world_size , ss.min_count() ,
-                           ss.output_format() , output_stream );
-  }
+// ****************************************************************************
+void send_self_results( const SatanSettings &ss , SelfResults &results ) {
 
-  for( int i = 1 ; i < world_size ; ++i ) {
-    DACLIB::mpi_send_string( string( "Finished" ) , i );
+  vector<char> block;
+  pack_self_results( results , block );
+  if( ss.compress_results() ) {
+    compress_block( block );
   }
+  DACLIB::send_block( block , 0 );
+  results = SelfResults();
 
 }
 
@@ -704,10 +1752,11 @@ void slave_event_loop() {
 #endif
 
   SatanSettings ss;
-  unsigned int num_probe_fps_to_do = 0;
   int chunk_num = 0;
   vector<pair<string,vector<pair<string,double> > > > nbs;
   vector<pair<string,vector<unsigned int> > > counts;
+  vector<vector<unsigned int> > nb_nums; // target numbers, for sharded runs
+  SelfResults self_results; // for --self runs
 
   while( 1 ) {
     
@@ -719,15 +1768,29 @@ void slave_event_loop() {
     if( string( "Finished" ) == msg ) {
       break;
     } else if( string( "Search_Details" ) == msg ) {
-      receive_search_details( ss , num_probe_fps_to_do , chunk_num );
-      process_fingerprints( ss , num_probe_fps_to_do , chunk_num ,  nbs , counts );
+      vector<FingerprintBase *> probe_fps;
+      receive_search_details( ss , chunk_num , probe_fps );
+      process_fingerprints( ss , probe_fps , nbs , counts );
+      tell_master_slave_has_done_nnlists();
+    } else if( string( "Shard_Search_Details" ) == msg ) {
+      slave_shard_search( ss , nbs , nb_nums , counts );
+      tell_master_slave_has_done_nnlists();
+    } else if( string( "Send_Shard_Results" ) == msg ) {
+      send_shard_results( ss , nbs , nb_nums , counts );
+    } else if( string( "Self_Search_Details" ) == msg ) {
+      slave_self_search( ss , self_results );
       tell_master_slave_has_done_nnlists();
+    } else if( string( "Send_Self_Results" ) == msg ) {
+      send_self_results( ss , self_results );
     } else if( string( "Send_Results" ) == msg ) {
       if( string( "COUNTS" ) == ss.output_format() ) {
-        send_results_to_master( chunk_num , counts );
+        send_results_to_master( ss , chunk_num , counts );
       } else {
-        send_results_to_master( chunk_num , nbs );
+        send_results_to_master( ss , chunk_num , nbs );
       }
+      // ready for the next chunk
+      nbs.clear();
+      counts.clear();
     } else if( string( "New_CWD" ) == msg  ) {
       receive_new_cwd();
     } else {
@@ -740,6 +1803,120 @@ void slave_event_loop() {
 
 }
 
+// ****************************************************************************
+// Work out from samples of the probes and targets how big the run would be.
+// Every probe is compared with every target.  In a parallel run the probes
+// are shared out between the slaves in CHUNKS_PER_SLAVE chunks each, and a
+// slave holds a chunk of probes, a block of targets and the neighbours of
+// the chunk's probes until the master asks for them.  With a probe chunk
+// size, the chunks are that size.  With --min-count, a probe's search stops
+// when it has enough neighbours, so the neighbours, time and output are an
+// upper limit.
+static const unsigned int ESTIMATE_SAMPLE_SIZE = 2000;
+
+void estimate_run( const SatanSettings &ss , int world_size ) {
+
+  unsigned int num_probes = 0 , num_targets = 0;
+  vector<FingerprintBase *> probe_sample , target_sample;
+  try {
+    sample_fp_file( ss.probe_file() , ss.input_format() , ss.bitstring_separator() ,
+                    ESTIMATE_SAMPLE_SIZE , num_probes , probe_sample );
+    sample_fp_file( ss.target_file() , ss.input_format() , ss.bitstring_separator() ,
+                    ESTIMATE_SAMPLE_SIZE , num_targets , target_sample );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
+
+  // COUNTS does the full distance for every pair, so the threshold is 1.0
+  bool counts_output = string( "COUNTS" ) == ss.output_format();
+  double threshold = counts_output ? 1.0 : ss.threshold();
+  double num_pairs , num_hits , secs_per_dist;
+  sample_distances( probe_sample , target_sample ,
+                    ss.probe_file() == ss.target_file() , threshold ,
+                    num_pairs , num_hits , secs_per_dist );
+
+  double np = num_probes , nt = num_targets;
+  // with --self, each pair is only done once
+  double num_dists = ss.self_search() ? np * ( np + 1.0 ) / 2.0 : np * nt;
+  double num_nbs = 0.0;
+  if( !counts_output && num_pairs > 0.0 ) {
+    num_nbs = num_dists * num_hits / num_pairs;
+    if( ss.min_count() ) {
+      num_nbs = min( num_nbs , np * ss.min_count() );
+    }
+  }
+  int num_workers = world_size > 1 ? world_size - 1 : 1;
+  double worker_probes = world_size > 1 ? ceil( np / ( CHUNKS_PER_SLAVE * num_workers ) ) : np;
+  if( ss.probe_chunk_size() > 0 ) {
+    worker_probes = min( worker_probes , double( ss.probe_chunk_size() ) );
+  }
+  double probe_name_len = mean_name_length( probe_sample );
+  double target_name_len = mean_name_length( target_sample );
+  double fps_bytes = worker_probes * mean_fp_bytes( probe_sample ) +
+      min( nt , double( ss.target_block_size() ) ) * mean_fp_bytes( target_sample );
+  double results_bytes = 0.0 , output_bytes = 0.0;
+  if( counts_output ) {
+    results_bytes = worker_probes * ( sizeof( pair<string,vector<unsigned int> > ) +
+                                      probe_name_len + 10 * sizeof( unsigned int ) );
+    output_bytes = np * ( probe_name_len + 85.0 );
+  } else {
+    results_bytes = worker_probes * ( sizeof( pair<string,vector<pair<string,double> > > ) +
+                                      probe_name_len ) +
+        num_nbs * worker_probes / max( np , 1.0 ) * ( sizeof( pair<string,double> ) + target_name_len );
+    if( string( "SATAN" ) == ss.output_format() ) {
+      output_bytes = num_nbs * ( probe_name_len + target_name_len + 11.0 );
+    } else if( string( "BINARY" ) == ss.output_format() ) {
+      // the name tables, a number and a count for each probe, and a
+      // number and a float for each neighbour
+      output_bytes = np * ( probe_name_len + 12.0 ) + nt * ( target_name_len + 4.0 ) +
+          num_nbs * 8.0;
+    } else {
+      output_bytes = np * ( probe_name_len + 8.0 ) + num_nbs * ( target_name_len + 18.0 );
+    }
+  }
+  double cpu_secs = num_dists * secs_per_dist;
+
+  cout << "Estimate for " << num_probes << " probes against " << num_targets
+       << " targets" ;
+  if( !counts_output ) {
+    cout << " at threshold " << ss.threshold();
+  }
+  cout << ", from samples of " << probe_sample.size() << " and "
+       << target_sample.size() << "." << endl;
+  if( !counts_output ) {
+    if( num_hits < 1.0 ) {
+      cout << "None of the " << num_pairs << " sampled pairs were within the threshold." << endl;
+    } else {
+      cout << num_hits << " of the " << num_pairs << " sampled pairs were within the"
+           << " threshold, which is good to about " << int( hits_error( num_hits ) + 0.5 )
+           << "%." << endl;
+    }
+  }
+  cout << "Distance calculations : " << num_dists << endl;
+  if( !counts_output ) {
+    cout << "Neighbours : " << num_nbs << " , " << ( np > 0.0 ? num_nbs / np : 0.0 )
+         << " per probe" << endl;
+  }
+  cout << "Fingerprints : " << bytes_string( fps_bytes ) << " in each process" << endl
+       << "Results : " << bytes_string( results_bytes ) << " in each process" << endl
+       << "Output file : " << bytes_string( output_bytes ) << endl
+       << "CPU time : " << time_string( cpu_secs ) << endl
+       << "Wall time : " << time_string( cpu_secs / ( num_workers * ss.num_threads() ) )
+       << " with " << num_workers << ( 1 == num_workers ? " process" : " processes" )
+       << " of " << ss.num_threads() << ( 1 == ss.num_threads() ? " thread" : " threads" )
+       << endl;
+
+  dump_fps( probe_sample );
+  dump_fps( target_sample );
+
+}
+
 // ****************************************************************************
 int main( int argc , char **argv ) {
 
@@ -767,6 +1944,10 @@ int main( int argc , char **argv ) {
   if( !ss ) {
     cout << "ERROR : " << ss.error_message() << endl << ss.usage_text() << endl;
     cerr << "ERROR : " << ss.error_message() << endl << ss.usage_text() << endl;
+    // the slaves are waiting to hear what to do
+    tell_slaves_finished( world_size );
+    MPI_Finalize();
+    exit( 1 );
   }
 
   if( TVERSKY == ss.similarity_calc() ) {
@@ -775,8 +1956,19 @@ int main( int argc , char **argv ) {
     NotHashedFingerprint::set_similarity_calc( ss.similarity_calc() );
   }
 
-  if( 1 == world_size ) {
+  if( ss.estimate() ) {
+    tell_slaves_finished( world_size );
+    estimate_run( ss , world_size );
+  } else if( ss.self_search() ) {
+    if( 1 == world_size ) {
+      self_serial_run( ss );
+    } else {
+      self_parallel_run( ss , world_size );
+    }
+  } else if( 1 == world_size ) {
     serial_run( ss );
+  } else if( ss.shard_targets() ) {
+    sharded_parallel_run( ss , world_size );
   } else {
     parallel_run( ss , world_size );
   }
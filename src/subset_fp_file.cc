@@ -214,7 +214,7 @@ int main( int argc , char **argv ) {
     cout << "Read " << fps.size() << " fingerprints" << endl;
   }
 
-  gzclose( gzfp );
+  close_fp_file_for_reading( gzfp );
 
   vector<string> subset_names;
   read_subset_names( subset_names_file , warm_feeling , subset_names );